@@ -0,0 +1,82 @@
+/*
+ * cli_os.h
+ *
+ *  Operating system abstraction of the shell, to run it in a task that sleeps until
+ *  there is something to do instead of calling cli_run periodically. CLI_OS selects the
+ *  implementation (e.g. in main.h):
+ *  - CLI_OS_NONE (default): no task, cli_run is called from the main loop. The weak
+ *    cli_wake_hook is called instead of the signal, see cli_pending,
+ *  - CLI_OS_FREERTOS: a direct to task notification wakes the shell task,
+ *  - CLI_OS_POSIX: a condition variable, for host builds and tests.
+ */
+
+#ifndef SHELL_INC_CLI_OS_H_
+#define SHELL_INC_CLI_OS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CLI_OS_NONE			0
+#define CLI_OS_FREERTOS		1
+#define CLI_OS_POSIX		2
+
+#ifndef CLI_OS
+#define CLI_OS				CLI_OS_NONE
+#endif
+
+#define CLI_OS_FOREVER		UINT32_MAX			/* timeout of cli_os_wait that never expires */
+
+#ifndef CLI_OS_POLL_MS
+#define CLI_OS_POLL_MS		100					/* wake-up period while there is delayed work (suppressed logs, transfer to retry) */
+#endif
+#ifndef CLI_OS_JOB_MS
+#define CLI_OS_JOB_MS		1					/* sleep between two time slices of a running command */
+#endif
+
+#if CLI_OS != CLI_OS_NONE
+/**
+  * @brief  			prepares the signal, from the shell task before anything can signal it
+  * @param  null
+  * @retval null
+  */
+void		cli_os_init(void);
+
+/**
+  * @brief  			wakes the shell task up. Can be called from interrupts and other tasks,
+  * 					a signal given while the task is not waiting is kept for its next wait.
+  * @param  null
+  * @retval null
+  */
+void		cli_os_signal(void);
+
+/**
+  * @brief  			puts the shell task to sleep until cli_os_signal is called
+  * @param  timeout_ms:	maximum time to wait, CLI_OS_FOREVER for no limit
+  * @retval null
+  */
+void		cli_os_wait(uint32_t timeout_ms);
+
+/**
+  * @brief  			tells if the caller is the shell task, the one that called cli_os_init
+  * @param  null
+  * @retval 			true in the shell task, false in the other tasks
+  */
+bool		cli_os_in_task(void);
+
+#define CLI_OS_SIGNAL()		cli_os_signal()
+#define CLI_OS_IN_TASK()	cli_os_in_task()
+#else
+/**
+  * @brief  			called (from the interrupts) when the shell has something new to do: the
+  * 					first byte received since cli_run emptied the queue, a deferred log, an
+  * 					error. Does nothing by default, redefine it to wake the main loop up.
+  * @param  null
+  * @retval null
+  */
+void		cli_wake_hook(void);
+
+#define CLI_OS_SIGNAL()		cli_wake_hook()
+#define CLI_OS_IN_TASK()	true
+#endif /* CLI_OS != CLI_OS_NONE */
+
+#endif /* SHELL_INC_CLI_OS_H_ */
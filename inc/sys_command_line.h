@@ -14,54 +14,373 @@
 #define __SYS_COMMAND_LINE_H
 
 #include "main.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "sys_queue.h"
 #include "vt100.h"
+#include "cli_os.h"
 
 /*
  *  Macro config
  */
 #define CLI_ENABLE          true            	/* command line enable/disable */
-#define HISTORY_MAX         10                  /* maximum number of history command */
-#define MAX_COMMAND_NB		32
+#ifndef HISTORY_BUFF_LEN
+#define HISTORY_BUFF_LEN    256                 /* bytes of history, a command takes its length + 2 */
+#endif
+#ifndef CLI_COMMANDS_INIT_NB
+#define CLI_COMMANDS_INIT_NB	16				/* commands allocated by the first CLI_ADD_CMD, the table then doubles when full */
+#endif
 #define MAX_ARGC			8
 #define MAX_LINE_LEN 		80
+#ifndef CLI_SEARCH_MAX
+#define CLI_SEARCH_MAX		16					/* maximum length of the reverse search (Ctrl-R) pattern */
+#endif
+
+/*
+ *  Reception mode
+ *  By default, the UART raises one interrupt per received character. Define CLI_RX_DMA
+ *  (e.g. in main.h) to receive through a circular DMA buffer instead: the DMA fills
+ *  the buffer in the background and the half/full/idle-line events only publish the
+ *  write index to the shell. The UART RX DMA channel must be set to circular mode.
+ */
+#ifndef CLI_RX_DMA_LENGTH
+#define CLI_RX_DMA_LENGTH	64					/* size of the circular DMA reception buffer, power of two */
+#endif
+#ifdef CLI_RX_DMA
+#define CLI_RX_LENGTH		CLI_RX_DMA_LENGTH	/* reception buffer of the default context */
+#else
+#define CLI_RX_LENGTH		SHELL_QUEUE_LENGTH
+#endif
+
+/*
+ *  Transmission
+ *  _write copies the text in a ring buffer and returns right away, the transfers are
+ *  chained from HAL_UART_TxCpltCallback (by DMA if CLI_TX_DMA is defined, with
+ *  interrupts otherwise). CLI_TX_FULL_POLICY selects what _write does when the text
+ *  does not fit in the ring.
+ */
+#define CLI_TX_BLOCK		0					/* wait until there is enough room (drops what does not fit when called from an interrupt) */
+#define CLI_TX_DROP			1					/* drop the whole text */
+#define CLI_TX_TRUNCATE		2					/* write what fits and drop the rest */
+
+#ifndef CLI_TX_BUFF_LENGTH
+#define CLI_TX_BUFF_LENGTH	256					/* size of the transmission ring buffer, power of two */
+#endif
+#ifndef CLI_TX_FULL_POLICY
+#define CLI_TX_FULL_POLICY	CLI_TX_BLOCK
+#endif
+
+/*
+ *  stdout buffering
+ *  The text printed is gathered by stdio before being given to _write, which saves a call
+ *  (and a critical section) per printf. CLI_STDOUT_BUFFERING is the mode given to setvbuf:
+ *  _IOLBF writes at each new line, _IOFBF only when the buffer is full, _IONBF at each
+ *  call. In all modes cli_run writes what is left at its end, if there is anything.
+ */
+#ifndef CLI_STDOUT_BUFFERING
+#define CLI_STDOUT_BUFFERING	_IOLBF
+#endif
+#ifndef CLI_STDOUT_BUFF_LENGTH
+#define CLI_STDOUT_BUFF_LENGTH	128				/* size of the stdout buffer, written when full */
+#endif
+
+/*
+ *  Deferred logs
+ *  Define CLI_LOG_DEFERRED to make LOG only record its format string, a timestamp and
+ *  its arguments in a ring, cli_run formats them later. The arguments are stored as
+ *  words (uintptr_t): only integers up to the size of a pointer, characters and
+ *  pointers can be given, and the strings printed with %s must remain valid.
+ */
+#ifndef CLI_LOG_RING_LENGTH
+#define CLI_LOG_RING_LENGTH	128					/* words of the deferred logs ring, power of two */
+#endif
+#define CLI_LOG_MAX_ARGS	6					/* maximum number of arguments of a deferred LOG */
+
+/*
+ *  Logs compiled in
+ *  The DBG, LOG and ERR calls below the CLI_LOG_LEVEL severity, and the LOG calls of the
+ *  categories that are not in CLI_LOG_COMPILE_MASK (bit 1 << CLI_LOG_xxx), compile to
+ *  nothing: their arguments are not evaluated and their strings are not in the binary.
+ *  The categories compiled in are still switched on and off at runtime by "log".
+ */
+#define CLI_LEVEL_DEBUG		0					/* DBG, LOG and ERR */
+#define CLI_LEVEL_LOG		1					/* LOG and ERR */
+#define CLI_LEVEL_ERROR		2					/* ERR */
+#define CLI_LEVEL_NONE		3					/* no log at all */
+
+#ifndef CLI_LOG_LEVEL
+#define CLI_LOG_LEVEL		CLI_LEVEL_DEBUG
+#endif
+#ifndef CLI_LOG_COMPILE_MASK
+#define CLI_LOG_COMPILE_MASK	0xFFFFFFFFUL		/* all the categories */
+#endif
+#define CLI_LOG_COMPILED(LOG_CAT)	((CLI_LOG_COMPILE_MASK >> (LOG_CAT)) & 1)
+
+/*
+ *  Logs rate limit
+ *  Each category can be limited to a number of LOGs per second (token bucket allowing a
+ *  burst of one second of LOGs). The LOGs over the limit are suppressed and counted, their
+ *  number is printed once the category is under its limit again. The limits are changed
+ *  at runtime by "log rate". Define CLI_LOG_RATES as a list of R(CAT, n) to set the
+ *  limit of some categories at compile time, e.g. R(SHELL, 10) R(CAT1, 100).
+ */
+#ifndef CLI_LOG_RATE_DEFAULT
+#define CLI_LOG_RATE_DEFAULT	0				/* LOGs per second of each category, 0 for no limit */
+#endif
+
+/*
+ *  Timestamps
+ *  Define CLI_TIMESTAMP to print the time of the LOG, DBG and ERR calls. The time is read
+ *  from CLI_TIMESTAMP_GET(), a free-running 32 bits counter running at CLI_TIMESTAMP_FREQ
+ *  per second: the DWT cycle counter by default (Cortex-M3 and above), started by cli_init,
+ *  or HAL_GetTick() in milliseconds on a core without DWT (Cortex-M0). Define both to use
+ *  another counter (a timer on a Cortex-M0, the system clock on a host build). The raw
+ *  count is only converted when the line is printed, in absolute or relative time. The
+ *  same counter times the commands, the echo latency and the budget of running commands.
+ */
+#define CLI_TIME_OFF		0					/* no timestamp */
+#define CLI_TIME_ABS		1					/* time since the counter started */
+#define CLI_TIME_REL		2					/* time since the previous timestamp */
+
+#ifndef CLI_TIMESTAMP_MODE
+#define CLI_TIMESTAMP_MODE	CLI_TIME_ABS
+#endif
+#ifndef CLI_TIMESTAMP_GET
+#ifdef DWT
+#define CLI_TIMESTAMP_DWT
+#define CLI_TIMESTAMP_GET()	(DWT->CYCCNT)
+#else
+#define CLI_TIMESTAMP_GET()	HAL_GetTick()
+#define CLI_TIMESTAMP_FREQ	1000U
+#endif
+#endif
+#ifndef CLI_TIMESTAMP_FREQ
+#define CLI_TIMESTAMP_FREQ	SystemCoreClock
+#endif
+
+#ifdef CLI_TIMESTAMP
+#define CLI_TIMESTAMP_PRINT(stream)	cli_timestamp_print((stream), CLI_TIMESTAMP_GET())
+#else
+#define CLI_TIMESTAMP_PRINT(stream)
+#endif
+
+/*
+ *  Commands profiling
+ *  Each call of a command is timed with CLI_TIMESTAMP_GET() (in cycles with the DWT
+ *  counter), for the time and cmdstats commands. Define CLI_CMD_PROFILE to 0 to remove
+ *  them, e.g. on a core without cycle counter nor replacement for it.
+ *  cmdstats keeps the statistics of the commands added at runtime, allocated with them.
+ *  The ones of the CLI_COMMAND commands would take a CMD_STATS_S of RAM per command
+ *  (32 bytes on a Cortex-M): define CLI_CMD_PROFILE_STATIC to 1 to keep them too.
+ */
+#ifndef CLI_CMD_PROFILE
+#define CLI_CMD_PROFILE		1
+#endif
+#ifndef CLI_CMD_PROFILE_STATIC
+#define CLI_CMD_PROFILE_STATIC	0
+#endif
+
+/*
+ *  Echo latency
+ *  Define CLI_LATENCY to measure, for each received byte, the time from its reception
+ *  (the UART interrupt, or the DMA event reporting it) to the hand-over of its echo to the
+ *  transmitter at the end of cli_run. The times, read with CLI_TIMESTAMP_GET(), are
+ *  counted in a histogram of powers of two shown by the latency command.
+ */
+#define CLI_LATENCY_BUCKETS	32					/* bucket i counts the times in [2^i, 2^(i+1)) */
+
+/*
+ *  Cooperative commands
+ *  A command that returns CLI_RUNNING is not done: cli_run calls it again, with the same
+ *  arguments, until it returns something else, for at most CLI_JOB_BUDGET_US per cli_run
+ *  so that the loop calling cli_run keeps its timing. CLI_WAITING is the same without
+ *  spending the budget: it is called again by the next cli_run only. Meanwhile the input is dropped,
+ *  except for Ctrl-C which cancels the command: it is called a last time with
+ *  CLI_CANCELLED() true, to release what it holds, and its result is ignored. Commands
+ *  that block can also poll CLI_CANCELLED() to stop early. CLI_KEY_HIT() tells if other
+ *  keys were received (and dropped), e.g. to stop on any key.
+ *  The CLI_PT_xxx macros write such a command as a sequence (protothread), the waits
+ *  end at once when it is cancelled. Its local variables are lost at each yield, the
+ *  ones to keep must be static (so it must not run on two shell contexts at once):
+ *
+ *  static uint8_t count(int argc, char *argv[]){
+ *      static int i;
+ *      static uint32_t start;
+ *      CLI_PT_BEGIN();
+ *      for(i = 0; i < 10 && !CLI_CANCELLED(); i++){
+ *          printf("%d\r\n", i);
+ *          start = HAL_GetTick();
+ *          CLI_PT_WAIT_UNTIL(HAL_GetTick() - start >= 1000);
+ *      }
+ *      CLI_PT_END(EXIT_SUCCESS);
+ *  }
+ */
+#define CLI_RUNNING			0xFF				/* returned by a command that is not done */
+#define CLI_WAITING			0xFE				/* returned by a command waiting for something, e.g. time */
+#ifndef CLI_JOB_BUDGET_US
+#define CLI_JOB_BUDGET_US	1000				/* time given to a running command by each cli_run, 0 for a single call,
+												   rounded down to a count of CLI_TIMESTAMP_GET() (to whole ms with HAL_GetTick()) */
+#endif
+
+/* the state of the running command is in its shell context (CLI_JOB_S) */
+#define CLI_JOB					(cli_ctx_current->job)
+#define CLI_CANCELLED()			(CLI_JOB.cancel != 0)
+#define CLI_KEY_HIT()			(CLI_JOB.key != 0)
+#define CLI_PT_BEGIN()			switch(CLI_JOB.lc) { case 0:
+#define CLI_PT_YIELD()			do { CLI_JOB.lc = __LINE__; return CLI_RUNNING; case __LINE__:; } while(0)
+#define CLI_PT_WAIT_UNTIL(cond)	do { CLI_JOB.lc = __LINE__; __attribute__((fallthrough)); case __LINE__: if(!(cond) && !CLI_CANCELLED()) { return CLI_WAITING; } } while(0)
+#define CLI_PT_EXIT(result)		do { CLI_JOB.lc = 0; return (result); } while(0)
+#define CLI_PT_END(result)		} CLI_JOB.lc = 0; return (result)
+
+/*
+ *  watch
+ *  "watch [-n ms] cmd [args]" runs a command every ms milliseconds (1000 by default, at
+ *  least CLI_WATCH_MIN_MS) and redraws its output in place, sending only the characters
+ *  that changed since the previous run, until a key is pressed. The output is captured in two buffers of
+ *  CLI_WATCH_BUFF_LENGTH bytes (the output shown and the new one), shared by the shell
+ *  contexts: one of them can watch at a time. What does not fit is not shown. The lines
+ *  are cut at CLI_WATCH_WIDTH characters and must all fit on the screen of the terminal.
+ *  Define CLI_WATCH to 0 to remove it.
+ */
+#ifndef CLI_WATCH
+#define CLI_WATCH			1
+#endif
+#ifndef CLI_WATCH_BUFF_LENGTH
+#define CLI_WATCH_BUFF_LENGTH	512				/* bytes of output of the watched command, twice in RAM */
+#endif
+#ifndef CLI_WATCH_MIN_MS
+#define CLI_WATCH_MIN_MS	10					/* shortest period of watch */
+#endif
+#ifndef CLI_WATCH_WIDTH
+#define CLI_WATCH_WIDTH		80					/* columns of the terminal, less than 255 */
+#endif
+
+/*
+ * Execution statistics of a command
+ */
+typedef struct {
+	uint32_t	calls;
+	uint64_t	total;			/* counts of CLI_TIMESTAMP_GET() spent in the command */
+	uint32_t	min;
+	uint32_t	max;
+	uint8_t		result;			/* returned by the last call */
+} CMD_STATS_S;
+
+/*
+ * Command entry
+ */
+typedef struct {
+    const char *pCmd;
+    const char *pHelp;
+    uint8_t (*pFun)(int argc, char *argv[]);
+    const char *(*pComplete)(int argc, char *argv[], size_t index);	/* arguments completion, can be NULL */
+    CMD_STATS_S *pStats;		/* in RAM, NULL if the command is not profiled */
+} COMMAND_S;
+
+/*
+ *  Commands declared at build time
+ *  CLI_COMMAND(name, help, fn) places a constant command entry in the cli_commands
+ *  section, found by the shell through the __start_/__stop_cli_commands symbols of the
+ *  linker: the command takes no RAM (but its statistics with CLI_CMD_PROFILE_STATIC, a
+ *  CMD_STATS_S per command) and needs no CLI_ADD_CMD. name is written without
+ *  quotes and must thus be a C identifier. The section is in link order and scanned;
+ *  define CLI_COMMANDS_HASH and build the file generated by tools/cli_commands_hash.py to
+ *  index it in flash: lookup in constant time, completion by binary search.
+ */
+#define CLI_COMMAND_SECTION_ATTR	__attribute__((used, section("cli_commands"), aligned(__alignof__(COMMAND_S))))
+
+#if defined(CLI_DISABLE)
+	#define CLI_COMMAND_COMPLETE(name, help, fn, complete)	_Static_assert(1, "shell disabled")
+#elif CLI_CMD_PROFILE && CLI_CMD_PROFILE_STATIC
+	#define CLI_COMMAND_COMPLETE(name, help, fn, complete)								\
+						static CMD_STATS_S cli_command_stats_##name;					\
+						const COMMAND_S cli_command_##name CLI_COMMAND_SECTION_ATTR	\
+							= { #name, (help), (fn), (complete), &cli_command_stats_##name }
+#else
+	#define CLI_COMMAND_COMPLETE(name, help, fn, complete)								\
+						const COMMAND_S cli_command_##name CLI_COMMAND_SECTION_ATTR	\
+							= { #name, (help), (fn), (complete), NULL }
+#endif /* CLI_DISABLE */
+#define CLI_COMMAND(name, help, fn)		CLI_COMMAND_COMPLETE(name, help, fn, NULL)
 
 #ifndef CLI_DISABLE
     #define CLI_INIT(...)       cli_init(__VA_ARGS__)
     #define CLI_RUN(...)        cli_run(__VA_ARGS__)
 	#define CLI_ADD_CMD(...)	cli_add_command(__VA_ARGS__)
+	#define CLI_ADD_COMPLETION(...)	cli_add_completion(__VA_ARGS__)
 #else
     #define CLI_INIT(...)       ;
     #define CLI_RUN(...)        ;
 	#define CLI_ADD_CMD(...)	;
+	#define CLI_ADD_COMPLETION(...)	;
 #endif /* CLI_DISABLE */
 
+#if CLI_LOG_LEVEL <= CLI_LEVEL_ERROR
 #define ERR(fmt, ...)  do {												\
+							CLI_TIMESTAMP_PRINT(stderr);				\
                             fprintf(stderr,								\
 								CLI_FONT_RED							\
 								"[ERROR] %s:%d: "fmt					\
 								CLI_FONT_DEFAULT,						\
                                 __FILE__, __LINE__, ##__VA_ARGS__);		\
                         }while(0)
+#else
+#define ERR(fmt, ...)	do { } while(0)
+#endif
 
+#if CLI_LOG_LEVEL > CLI_LEVEL_LOG
+#define LOG(LOG_CAT, fmt, ...)	do { } while(0)
+#elif !defined(CLI_LOG_DEFERRED)
 #define LOG(LOG_CAT, fmt, ...)											\
-						if((1<<LOG_CAT)&cli_log_stat) {					\
+						if(CLI_LOG_COMPILED(LOG_CAT)					\
+								&& ((1<<LOG_CAT)&cli_log_stat)			\
+								&& cli_log_allow(LOG_CAT)) {			\
+							CLI_TIMESTAMP_PRINT(stdout);				\
                             printf(CLI_FONT_CYAN						\
 								"[%s]: "fmt								\
 								CLI_FONT_DEFAULT,						\
 								cli_logs_names[LOG_CAT],				\
 								##__VA_ARGS__);							\
                         }
+#else
+#define LOG(LOG_CAT, fmt, ...)											\
+						if(CLI_LOG_COMPILED(LOG_CAT)					\
+								&& ((1<<LOG_CAT)&cli_log_stat)			\
+								&& cli_log_allow(LOG_CAT)) {			\
+							cli_log_defer(LOG_CAT, fmt,					\
+								CLI_LOG_NARGS(__VA_ARGS__),				\
+								(const uintptr_t[]){ 0					\
+								CLI_LOG_ARGS(__VA_ARGS__) } + 1);		\
+                        }
+#endif /* CLI_LOG_DEFERRED */
+
+/* number of arguments (up to CLI_LOG_MAX_ARGS) and their conversion to words, for the deferred LOG */
+#define CLI_LOG_NARGS(...)				CLI_LOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define CLI_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...)	n
+#define CLI_LOG_ARGS(...)				CLI_LOG_ARGS_(CLI_LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define CLI_LOG_ARGS_(n, ...)			CLI_LOG_ARGS__(n, ##__VA_ARGS__)
+#define CLI_LOG_ARGS__(n, ...)			CLI_LOG_ARGS_##n(__VA_ARGS__)
+#define CLI_LOG_ARGS_0()
+#define CLI_LOG_ARGS_1(a)				, (uintptr_t)(a)
+#define CLI_LOG_ARGS_2(a, ...)			, (uintptr_t)(a) CLI_LOG_ARGS_1(__VA_ARGS__)
+#define CLI_LOG_ARGS_3(a, ...)			, (uintptr_t)(a) CLI_LOG_ARGS_2(__VA_ARGS__)
+#define CLI_LOG_ARGS_4(a, ...)			, (uintptr_t)(a) CLI_LOG_ARGS_3(__VA_ARGS__)
+#define CLI_LOG_ARGS_5(a, ...)			, (uintptr_t)(a) CLI_LOG_ARGS_4(__VA_ARGS__)
+#define CLI_LOG_ARGS_6(a, ...)			, (uintptr_t)(a) CLI_LOG_ARGS_5(__VA_ARGS__)
 
+#if CLI_LOG_LEVEL <= CLI_LEVEL_DEBUG
 #define DBG(fmt, ...)  do {												\
+							CLI_TIMESTAMP_PRINT(stdout);				\
                             printf(CLI_FONT_YELLOW						\
 							"[Debug] %s:%d: "fmt						\
 							CLI_FONT_DEFAULT,							\
                                 __FILE__, __LINE__, ##__VA_ARGS__);		\
                         } while(0)
+#else
+#define DBG(fmt, ...)	do { } while(0)
+#endif
 
 #define DIE(fmt, ...)   do {											\
                             TERMINAL_FONT_RED();						\
@@ -99,22 +418,319 @@ extern char *cli_logs_names[];
 
 extern uint32_t cli_log_stat;
 
+/**
+  * @brief  		takes a LOG from the rate limit of its category, called by LOG
+  * @param  cat:	log category
+  * @retval 		true if the LOG can be printed, false if it is suppressed
+  */
+uint8_t 	cli_log_allow(uint8_t cat);
+
+#ifdef CLI_TIMESTAMP
+extern uint8_t cli_timestamp_mode;
 
 /**
-  * @brief  command line init.
+  * @brief  		prints a timestamp in the current mode (cli_timestamp_mode)
+  * @param  stream:	stream to print it to
+  * @param  ts:		raw value of CLI_TIMESTAMP_GET()
+  * @retval null
+  */
+void 		cli_timestamp_print(FILE *stream, uint32_t ts);
+#endif
+
+#ifdef CLI_LOG_DEFERRED
+extern volatile uint32_t cli_log_dropped;
+
+/**
+  * @brief  		records a deferred log, called by LOG. Can be called from interrupts.
+  * @param  cat:	log category
+  * @param  fmt:	format string, must remain valid
+  * @param  nargs:	number of arguments
+  * @param  args:	arguments, converted to words
+  * @retval null
+  */
+void 		cli_log_defer(uint8_t cat, const char *fmt, uint8_t nargs, const uintptr_t *args);
+#endif
+
+/*
+ * Health counters of the shell, shown and reset by the stats command. They are always
+ * counted, since CLI_INIT or the last "stats reset".
+ */
+typedef struct {
+	uint32_t	rx_bytes;			/* bytes received */
+	uint32_t	rx_dropped;			/* bytes lost because the reception queue was full */
+	uint32_t	rx_high_water;		/* most bytes waiting in the reception queue */
+	uint32_t	uart_overrun;		/* UART errors (HAL_UART_ErrorCallback), by flag */
+	uint32_t	uart_framing;
+	uint32_t	uart_noise;
+	uint32_t	uart_parity;
+	uint32_t	uart_dma;
+	uint32_t	tx_bytes;			/* bytes queued for transmission */
+	uint32_t	tx_dropped;			/* bytes lost because the transmission ring was full */
+	uint32_t	tx_high_water;		/* most bytes waiting in the transmission ring */
+	uint32_t	tx_blocked_ms;		/* time spent by printf waiting for room in the ring */
+	uint32_t	tx_errors;			/* transfers refused by the HAL, counted once each until accepted */
+	uint32_t	lines_truncated;	/* lines longer than MAX_LINE_LEN, dropped */
+} CLI_STATS_S;
+
+/*
+ *  Shell contexts
+ *  The state of a shell (reception and transmission buffers, line editor, history,
+ *  running command, counters) is held in a context, so that independent shells can
+ *  serve several transports at once: two UARTs, a UART and a USB CDC port... They all
+ *  share the commands, the logs and stdout, and are all run by cli_run. cli_init sets up
+ *  the default context, cli_console, which also prints the logs and what is printed from
+ *  interrupts. The other contexts are defined with CLI_CTX_DEFINE, which sets the sizes
+ *  of their buffers, then started with cli_ctx_add_uart or cli_ctx_add. A context takes
+ *  CLI_CTX_RAM(rx_len, tx_len, history_len) bytes of RAM.
+ */
+#define CLI_SEARCH_PROMPT		"(reverse-i-search)`"
+#define CLI_SEARCH_FAILING		"(failing reverse-i-search)`"
+#define CLI_SEARCH_SEPARATOR	"': "
+/* longest text displayed in place of the line, the reverse search view */
+#define CLI_SHOWN_LEN			(sizeof(CLI_SEARCH_FAILING) + CLI_SEARCH_MAX + sizeof(CLI_SEARCH_SEPARATOR) + MAX_LINE_LEN)
+
+/*
+ * Buffer for current line
+ */
+typedef struct {
+    uint8_t buff[MAX_LINE_LEN];
+    uint8_t len;
+    uint8_t cursor;						/* insertion point in buff */
+    uint8_t shown[CLI_SHOWN_LEN];		/* line as currently displayed by the terminal */
+    uint8_t shown_len;
+    uint8_t shown_cursor;
+} HANDLE_TYPE_S;
+
+/*
+ * Command line history
+ * The commands are packed in buff, oldest first, as [len][command][len] entries so
+ * that the history can be stepped through in both directions in constant time.
+ */
+typedef struct {
+    uint8_t *buff;
+    uint16_t size;		/* bytes of buff */
+    uint16_t end;		/* end of the newest entry */
+    uint16_t show;		/* start of the entry being shown, end if none is */
+}HISTORY_S;
+
+/*
+ * Reverse history search (Ctrl-R) state
+ */
+typedef struct {
+	bool active;
+	bool failing;					/* the pattern is not found in the history */
+	char pattern[CLI_SEARCH_MAX];
+	uint8_t len;
+	uint16_t match;					/* start of the matching history entry, HISTORY_NONE if none */
+	uint8_t at;						/* position of the pattern in the match */
+}SEARCH_S;
+
+/*
+ * Command that returned CLI_RUNNING, called again by cli_run
+ */
+typedef struct {
+	bool				running;
+	int					argc;
+	char				*argv[MAX_ARGC];	/* in line */
+	char				line[MAX_LINE_LEN];	/* copy of the tokenized line, the editor reuses its buffer */
+	uint16_t			lc;					/* line a CLI_PT_xxx command resumes at, 0 when it starts */
+	volatile uint8_t	cancel;				/* Ctrl-C received since the command started */
+	uint8_t				key;				/* keys received while the command runs */
+} CLI_JOB_S;
+
+typedef struct cli_ctx cli_ctx_s;
+
+/**
+  * @brief  		transmission of a context whose transport is not a UART (see cli_ctx_add)
+  * @param  ctx:	context
+  * @param  data:	text to send, valid until the transmission is done
+  * @param  len:	its length
+  * @retval 		0 if the transmission started, cli_ctx_tx_done must then be called once it
+  * 				is done (possibly before returning). Anything else if the transport is
+  * 				busy, the next cli_run tries again.
+  */
+typedef int (*cli_transmit_f)(cli_ctx_s *ctx, const uint8_t *data, uint16_t len);
+
+struct cli_ctx {
+	/* transport */
+	UART_HandleTypeDef	*huart;				/* NULL if the transport is not a UART */
+	cli_transmit_f		transmit;			/* transport that is not a UART */
+	void				*user;				/* free for the transport */
+	cli_ctx_s			*next;				/* contexts run by cli_run, after cli_console */
+
+	/* reception */
+	shell_queue_s		rx_buff;			/* characters received, not handled yet */
+	uint8_t				cBuffer;			/* character being received (UART, interrupt mode) */
+	volatile bool		rx_rearm;			/* UART, DMA mode: the HAL stopped the DMA on an error */
+	volatile bool		rx_lapped;			/* UART, DMA mode: the DMA overwrote bytes not read yet */
+	uint16_t			rx_dma_pos;			/* UART, DMA mode: position of the DMA at the last event */
+
+	/* transmission */
+	shell_queue_s		tx_buff;			/* text waiting to be transmitted */
+	volatile size_t		tx_xfer;			/* length of the transfer in progress, 0 when the transport is idle */
+	bool				tx_refused;			/* the transport refused the pending transfer, already counted */
+
+	/* shell */
+	bool				password_ok;
+	HANDLE_TYPE_S		line;				/* line being edited */
+	vt100_decoder_s		decoder;
+	bool				tab_pending;		/* last key was a Tab with several candidates, the next one lists them */
+	HISTORY_S			history;
+	SEARCH_S			search;
+	CLI_JOB_S			job;
+	CLI_STATS_S			stats;
+#ifdef CLI_LATENCY
+	uint32_t			*rx_stamps;			/* time of reception of each byte of rx_buff */
+	uint32_t			*echo_stamps;		/* of the bytes read by this cli_run, waiting for their echo */
+	size_t				echo_nb;
+	uint32_t			latency[CLI_LATENCY_BUCKETS];
+#endif
+};
+
+#ifdef CLI_LATENCY
+#define CLI_CTX_LATENCY_DEFINE(name, rx_len)	static uint32_t name##_rx_stamps[rx_len], name##_echo_stamps[rx_len];
+#define CLI_CTX_LATENCY_INIT(name)				.rx_stamps = name##_rx_stamps, .echo_stamps = name##_echo_stamps,
+#define CLI_CTX_LATENCY_RAM(rx_len)				(2 * (rx_len) * sizeof(uint32_t))
+#else
+#define CLI_CTX_LATENCY_DEFINE(name, rx_len)
+#define CLI_CTX_LATENCY_INIT(name)
+#define CLI_CTX_LATENCY_RAM(rx_len)				0
+#endif
+
+/*
+ * Defines a context (cli_ctx_s name) and its buffers, at file scope. rx_len is the
+ * size of the reception queue (of the circular DMA buffer for a UART with CLI_RX_DMA),
+ * tx_len the size of the transmission ring, both powers of two, and history_len the
+ * bytes of history (up to 65535).
+ */
+#define CLI_CTX_DEFINE(name, rx_len, tx_len, history_len)									\
+	_Static_assert(SHELL_QUEUE_IS_POW2(rx_len) && SHELL_QUEUE_IS_POW2(tx_len),						\
+			"the buffers of a shell context must be powers of two");						\
+	_Static_assert((history_len) <= UINT16_MAX, "history_len is at most 65535 bytes");		\
+	static uint8_t name##_rx_pool[rx_len];													\
+	static uint8_t name##_tx_pool[tx_len];													\
+	static uint8_t name##_history[history_len];												\
+	CLI_CTX_LATENCY_DEFINE(name, rx_len)													\
+	cli_ctx_s name = {																			\
+		.rx_buff = { .Mask = (rx_len) - 1, .PBase = name##_rx_pool },							\
+		.tx_buff = { .Mask = (tx_len) - 1, .PBase = name##_tx_pool },							\
+		.history = { .buff = name##_history, .size = (history_len) },							\
+		CLI_CTX_LATENCY_INIT(name)															\
+	}
+
+/* RAM taken by a context and its buffers */
+#define CLI_CTX_RAM(rx_len, tx_len, history_len)	\
+	(sizeof(cli_ctx_s) + (rx_len) + (tx_len) + (history_len) + CLI_CTX_LATENCY_RAM(rx_len))
+
+extern cli_ctx_s	cli_console;		/* default context, of cli_init */
+extern cli_ctx_s	*cli_ctx_current;	/* context running a command, cli_console outside of cli_run and
+										   for the interrupts and the other tasks */
+
+/**
+  * @brief  command line init: sets up what the contexts share and starts cli_console.
   * @param  handle to uart peripheral
   * @retval null
   */
 void 		cli_init(UART_HandleTypeDef *handle_uart);
 
 /**
-  * @brief  command line task, schedule by sys. every 50ms
+  * @brief  			starts another shell on a UART, after cli_init (from cli_task_setup with
+  * 					CLI_OS)
+  * @param  ctx:		context, defined with CLI_CTX_DEFINE
+  * @param  huart:		UART, received in the same mode as the one of cli_init
+  * @retval null
+  */
+void 		cli_ctx_add_uart(cli_ctx_s *ctx, UART_HandleTypeDef *huart);
+
+/**
+  * @brief  			starts another shell on a transport that is not a UART (e.g. USB
+  * 					CDC), after cli_init (from cli_task_setup with CLI_OS). The transport
+  * 					hands the characters it receives
+  * 					to cli_ctx_receive and calls cli_ctx_tx_done when a transmission is done.
+  * @param  ctx:		context, defined with CLI_CTX_DEFINE
+  * @param  transmit:	starts a transmission
+  * @param  user:		stored in ctx->user for the transport
+  * @retval null
+  */
+void 		cli_ctx_add(cli_ctx_s *ctx, cli_transmit_f transmit, void *user);
+
+/**
+  * @brief  			hands received characters to a context, from the reception callback of
+  * 					its transport (interrupts included). What does not fit in the
+  * 					reception queue is dropped.
+  * @param  ctx:		context
+  * @param  data:		characters received
+  * @param  len:		their number
+  * @retval null
+  */
+void 		cli_ctx_receive(cli_ctx_s *ctx, const uint8_t *data, size_t len);
+
+/**
+  * @brief  			tells a context that its transmission is done, from the transmission
+  * 					callback of its transport (interrupts included)
+  * @param  ctx:		context
+  * @retval null
+  */
+void 		cli_ctx_tx_done(cli_ctx_s *ctx);
+
+/**
+  * @brief  command line task: handles the characters received, the running command, the
+  * 		logs and the transmission of each context. Called from the main loop, as often
+  * 		as the input latency must be low (or by cli_task, see CLI_OS). All the contexts
+  * 		must be run by the same task, as they share stdout.
   * @param  null
   * @retval null
   */
 void 		cli_run(void);
 
+/* what cli_pending reports */
+#define CLI_PENDING_RX		0x01				/* received characters, or a reception to restart, for cli_run */
+#define CLI_PENDING_LOG		0x02				/* deferred logs to format, for cli_run */
+#define CLI_PENDING_OUTPUT	0x04				/* text in the stdout buffer, for cli_run */
+#define CLI_PENDING_TX		0x08				/* transfer in progress, finished by the interrupts */
+#define CLI_PENDING_TIMER	0x10				/* suppressed logs to report or a transfer to retry: cli_run must be called again within CLI_OS_POLL_MS */
+#define CLI_PENDING_JOB		0x20				/* command running (CLI_RUNNING or CLI_WAITING), resumed by cli_run */
+#define CLI_PENDING_RUN		(CLI_PENDING_RX | CLI_PENDING_LOG | CLI_PENDING_OUTPUT | CLI_PENDING_JOB)
+
+/**
+  * @brief  tells what the shell has left to do, e.g. to call cli_run only when needed
+  * 		and sleep otherwise. Can be called with the interrupts masked.
+  * @param  null
+  * @retval CLI_PENDING_xxx flags, 0 if the shell is idle
+  */
+uint8_t 	cli_pending(void);
+
+#if CLI_OS != CLI_OS_NONE
+/**
+  * @brief  			shell task: inits the shell, calls cli_task_setup, then calls cli_run
+  * 					each time it is woken up by the reception, a deferred log or an error.
+  * 					Never returns.
+  * @param  argument:	UART handle (UART_HandleTypeDef *), as for cli_init
+  * @retval null
+  */
+void 		cli_task(void *argument);
+
+/**
+  * @brief  			called by cli_task once cli_init is done, before it runs the shell. Does
+  * 					nothing by default, redefine it to start the other contexts: they must
+  * 					be added from the shell task, before cli_run runs them.
+  * @param  null
+  * @retval null
+  */
+void 		cli_task_setup(void);
+#endif
+
 void 		cli_add_command(const char *command, const char *help, uint8_t (*exec)(int argc, char *argv[]));
 
+/**
+  * @brief  		adds the completion of the arguments of a command (Tab key)
+  * @param  command:	name of a command already added
+  * @param  complete:	returns the index-th candidate for the last word of argv (the one being
+  * 					completed, possibly empty), NULL when there are no more candidates.
+  * 					The candidates that do not start with the word are skipped by the shell.
+  * @retval null
+  */
+void 		cli_add_completion(const char *command, const char *(*complete)(int argc, char *argv[], size_t index));
+
 #endif /* __SYS_COMMAND_LINE_H */
 
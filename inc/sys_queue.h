@@ -5,7 +5,11 @@
   * @version:   V1.0
   * @date:      2018-1-18
   * @brief:     queue
-  * @attention:
+  * @attention: single producer / single consumer ring. The producer (e.g. an
+  *             interrupt) only moves Rear and the consumer only moves Front so
+  *             that no lock is needed between them. Both indexes run freely and
+  *             are masked when accessing PBase, the length of the queue must
+  *             thus be a power of two.
   ******************************************************************************
   */
 
@@ -14,23 +18,43 @@
 #define __SYS_QUEUE_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifndef SHELL_QUEUE_LENGTH
 	#define SHELL_QUEUE_LENGTH 32
 #endif
 
-typedef struct queue {
-	size_t		Front;
-	size_t 		Rear;
-	uint8_t		PBase[SHELL_QUEUE_LENGTH];
+#define SHELL_QUEUE_IS_POW2(len)	((len) != 0 && (((len) & ((len) - 1)) == 0))
+
+/*
+ * Inits a queue on a statically allocated array, checking its length at compile time.
+ */
+#define SHELL_QUEUE_INIT(queue, pool)	do {														\
+											_Static_assert(SHELL_QUEUE_IS_POW2(sizeof(pool)),		\
+												"the length of a shell queue must be a power of two");	\
+											shell_queue_init((queue), (pool), sizeof(pool));		\
+										} while(0)
 
+typedef struct queue {
+	size_t		Front;		/* read index, only written by the consumer */
+	size_t 		Rear;		/* write index, only written by the producer */
+	size_t		Mask;		/* length of PBase - 1 */
+	uint8_t		*PBase;
 } shell_queue_s;
 
-uint8_t shell_queue_init(shell_queue_s *queue);
+uint8_t shell_queue_init(shell_queue_s *queue, uint8_t *pool, size_t length);
 uint8_t shell_queue_full(shell_queue_s *queue);
 uint8_t shell_queue_empty(shell_queue_s *queue);
+size_t	shell_queue_count(shell_queue_s *queue);
+size_t	shell_queue_room(shell_queue_s *queue);
 uint8_t shell_queue_in(shell_queue_s *queue, uint8_t *PData);
 uint8_t shell_queue_out(shell_queue_s *queue, uint8_t *PData);
+size_t	shell_queue_in_bulk(shell_queue_s *queue, const uint8_t *data, size_t len);
+size_t	shell_queue_out_bulk(shell_queue_s *queue, uint8_t *data, size_t len);
+size_t	shell_queue_peek_span(shell_queue_s *queue, uint8_t **span);
+void	shell_queue_release(shell_queue_s *queue, size_t len);
+size_t	shell_queue_reserve_span(shell_queue_s *queue, uint8_t **span);
+size_t	shell_queue_commit(shell_queue_s *queue, size_t len);
 
 #endif /* __SYS_QUEUE_H */
 
@@ -10,6 +10,8 @@
 #ifndef SHELL_INC_VT100_H_
 #define SHELL_INC_VT100_H_
 
+#include <stdint.h>
+
 #define KEY_UP              "\x1b\x5b\x41"  /* [up] key: 0x1b 0x5b 0x41 */
 #define KEY_DOWN            "\x1b\x5b\x42"  /* [down] key: 0x1b 0x5b 0x42 */
 #define KEY_RIGHT           "\x1b\x5b\x43"  /* [right] key: 0x1b 0x5b 0x43 */
@@ -18,6 +20,85 @@
 #define KEY_BACKSPACE       '\b'            /* [backspace] key */
 #define KEY_DEL				'\x7f'			/* [DEL] key */
 #define KEY_DELETE			"\x1b\x5b\x33\x7e" /*[Delete] key */
+#define KEY_CTRL_C			'\x03'			/* [Ctrl-C] key, interrupt */
+
+/* input decoder-------------------------------------------------------BEGIN */
+
+/*
+    The decoder is fed one received byte at a time and reports a key as soon as the
+    last byte of its sequence is received, so that sequences split across several
+    receptions are handled. It understands:
+        ESC [ <params> <final>      CSI sequences (arrows, Home/End, ~ sequences)
+        ESC O <final>               SS3 sequences (arrows, Home/End on some keypads)
+        ESC <char>                  Alt + char
+        0x00 -- 0x1f, 0x7f          control keys
+*/
+
+typedef enum {
+    VT100_KEY_NONE = 0,     /* byte consumed, no key yet */
+    VT100_KEY_CHAR,         /* printable character (or UTF-8 byte), in ch */
+    VT100_KEY_ENTER,        /* CR, LF or CR LF */
+    VT100_KEY_BACKSPACE,    /* BS or DEL */
+    VT100_KEY_TAB,
+    VT100_KEY_CTRL,         /* Ctrl + letter, the letter ('a' -- 'z') is in ch */
+    VT100_KEY_UP,
+    VT100_KEY_DOWN,
+    VT100_KEY_RIGHT,
+    VT100_KEY_LEFT,
+    VT100_KEY_HOME,
+    VT100_KEY_END,
+    VT100_KEY_INSERT,
+    VT100_KEY_DELETE,
+    VT100_KEY_PAGE_UP,
+    VT100_KEY_PAGE_DOWN,
+} vt100_key_e;
+
+/* modifiers reported with a key */
+#define VT100_MOD_SHIFT     0x01
+#define VT100_MOD_ALT       0x02
+#define VT100_MOD_CTRL      0x04
+
+#define VT100_MAX_PARAMS    2
+
+typedef struct {
+    uint8_t     key;        /* vt100_key_e */
+    uint8_t     mod;        /* VT100_MOD_xxx */
+    char        ch;
+} vt100_key_s;
+
+typedef struct {
+    uint8_t     state;
+    uint8_t     nparam;
+    uint8_t     last_cr;    /* last byte was a CR, to merge CR LF in a single ENTER */
+    uint16_t    param[VT100_MAX_PARAMS];
+} vt100_decoder_s;
+
+void    vt100_decoder_init  (vt100_decoder_s *dec);
+uint8_t vt100_decode        (vt100_decoder_s *dec, uint8_t c, vt100_key_s *key);
+
+/* input decoder---------------------------------------------------------END */
+
+/* line update---------------------------------------------------------BEGIN */
+
+/*
+    Computes the characters to send to turn the line displayed by the terminal into
+    a new one: the cursor is moved to the first difference, only the characters
+    that changed are written and the rest of the line is cleared if it got shorter.
+    Cursor moves use BS or re-print the characters when that is shorter than the
+    equivalent escape sequence. Both lines are on the same terminal row, the column
+    0 being the first character after the prompt.
+*/
+
+/* size of the output buffer needed for lines of at most len characters */
+#define VT100_LINE_UPDATE_SIZE(len)     ((len) + 16)
+
+/* cursor given to vt100_line_update to leave it after the last character written */
+#define VT100_CURSOR_KEEP               0xFF
+
+uint16_t vt100_line_update  (char *out, const uint8_t *old, uint8_t old_len, uint8_t old_cursor,
+                             const uint8_t *line, uint8_t len, uint8_t cursor);
+
+/* line update-----------------------------------------------------------END */
 
 enum {
     E_FONT_BLACK,
@@ -86,6 +167,8 @@ enum {
         \033[nC     cursor move right n lines
         \033[nD     cursor left up n lines
         \033[y;xH   set cursor position
+        \033[xG     set cursor column
+        \033[J      clear to the end of the screen
         \033[2J     clear all display
         \033[K      clear line
         \033[s      save cursor position
@@ -159,6 +242,9 @@ enum {
 /* terminal clear all */
 #define TERMINAL_DISPLAY_CLEAR()    printf("\033[2J")
 
+/* terminal clear from the cursor to the end of the screen */
+#define TERMINAL_CLEAR_DOWN()       printf("\033[J")
+
 /* cursor move up */
 #define TERMINAL_MOVE_UP(x)         do{ if(x>0) printf("\033[%dA", (x)); }while(0)
 
@@ -174,6 +260,9 @@ enum {
 /* cursor move to */
 #define TERMINAL_MOVE_TO(x, y)      printf("\033[%d;%dH", (x), (y))
 
+/* cursor move to the start of the line */
+#define TERMINAL_MOVE_HOME()        printf("\r")
+
 /* cursor reset */
 #define TERMINAL_RESET_CURSOR()     printf("\033[H")
 
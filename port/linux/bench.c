@@ -0,0 +1,586 @@
+/*
+ * bench.c
+ *
+ *  Benchmarks of the hot paths of the shell, on the Linux port without terminal: the
+ *  received bytes are injected in the UART and the transmitted ones are counted. The shell
+ *  is built in this file, so that its internal functions can be timed. The results are
+ *  printed on the standard output in JSON, to be compared release to release.
+ *
+ *  gcc -std=gnu11 -O2 -Iport/linux -Iinc port/linux/bench.c port/linux/hal_linux.c \
+ *      src/sys_queue.c src/vt100.c src/cli_os.c -lpthread -o ushell_bench
+ *
+ *  Add the configuration to benchmark with -D, e.g. -DCLI_LOG_DEFERRED -DCLI_RX_DMA.
+ *  The times are in nanoseconds and, on x86, in ticks of the time-stamp counter.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* BENCH is logged, OFF is disabled at run time, LIMITED is over its rate and MASKED is compiled out */
+#define CLI_ADDITIONAL_LOG_CATEGORIES	X(BENCH, true) X(OFF, false) X(LIMITED, true) X(MASKED, true)
+#define CLI_LOG_COMPILE_MASK			(~(1UL << CLI_LOG_MASKED))
+#define CLI_LOG_RATES					R(LIMITED, 1)
+
+#include "../../src/sys_command_line.c"
+
+#define BENCH_RX_BYTES		(4UL << 20)		/* bytes received by the throughput benchmarks */
+#define BENCH_DECODE_BYTES	(16UL << 20)
+#define BENCH_LOOKUPS		1000000UL
+#define BENCH_EXECS			20000UL
+#define BENCH_LOGS			200000UL
+#define BENCH_LOG_BATCH		16				/* LOGs between two cli_run, fits in the deferred ring */
+#define BENCH_MAX_COMMANDS	1024
+#define BENCH_HISTORY_ADDS	100000UL		/* commands added to the history, for its depth and its cost */
+#define BENCH_HISTORY_WALKS	100000UL		/* walks through the whole history with [up] */
+#define BENCH_QUEUE_BYTES	(16UL << 20)	/* bytes through the queue, for its throughput and its stress test */
+#define BENCH_QUEUE_LENGTH	64				/* small, for the indexes to wrap often */
+#define BENCH_QUEUE_CHUNK	16				/* bytes written then read at once by the throughput benchmark */
+
+typedef struct {
+	uint64_t ns;
+	uint64_t tsc;
+} bench_time_s;
+
+UART_HandleTypeDef	huart1;
+static uint64_t		wire_bytes;				/* bytes transmitted by the UART */
+static char			names[BENCH_MAX_COMMANDS][8];
+
+static void sink(const uint8_t *data, uint16_t len)
+{
+	(void)data;
+	wire_bytes += len;
+}
+
+static uint8_t nop(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+	return EXIT_SUCCESS;
+}
+
+static bench_time_s bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (bench_time_s){
+		.ns = (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec,
+#if defined(__x86_64__) || defined(__i386__)
+		.tsc = __rdtsc(),
+#endif
+	};
+}
+
+static bench_time_s bench_since(bench_time_s start)
+{
+	bench_time_s now = bench_now();
+
+	return (bench_time_s){ .ns = now.ns - start.ns, .tsc = now.tsc - start.tsc };
+}
+
+/**
+  * @brief  		receives data as fast as the shell handles it: each call of cli_run is given
+  * 				as many bytes as there is room for in the reception queue, so none is lost
+  * @param  data:	pattern, repeated
+  * @param  len:	length of the pattern
+  * @param  total:	number of bytes to receive
+  */
+static void bench_feed(const char *data, size_t len, size_t total)
+{
+	size_t pos = 0;
+
+	while(total != 0){
+		size_t n = shell_queue_room(&cli_console.rx_buff);
+		n = (n < total) ? n : total;
+		n = (n < len - pos) ? n : len - pos;
+		hal_linux_uart_receive((const uint8_t *)&data[pos], n);
+		cli_run();
+		pos = (pos + n) % len;
+		total -= n;
+	}
+}
+
+/**
+  * @brief  		bytes transmitted in answer to some input
+  */
+static uint64_t bench_wire(const char *input)
+{
+	cli_run();
+	wire_bytes = 0;
+	bench_feed(input, strlen(input), strlen(input));
+	cli_run();
+	return wire_bytes;
+}
+
+static void print_time(FILE *out, const char *name, bench_time_s t, uint64_t n, const char *unit)
+{
+	fprintf(out, "\"%s_ns_per_%s\": %.2f, \"%s_tsc_per_%s\": %.2f",
+			name, unit, (double)t.ns / n, name, unit, (double)t.tsc / n);
+}
+
+/*
+ * Stress test of the queue: a producer and a consumer thread move a known sequence through
+ * it, each one with its bulk and its in place (span) operations in turn and with lengths
+ * going through every size from 1 to the length of the queue.
+ */
+static shell_queue_s	stress_queue;
+static uint8_t			stress_pool[BENCH_QUEUE_LENGTH];
+
+static void *stress_producer(void *arg)
+{
+	uint8_t data[BENCH_QUEUE_LENGTH];
+	size_t sent = 0;
+	size_t size = 0;
+	uint8_t next = 0;
+
+	(void)arg;
+	while(sent < BENCH_QUEUE_BYTES){
+		size_t len = size % BENCH_QUEUE_LENGTH + 1;
+		size_t n;
+
+		if(len > BENCH_QUEUE_BYTES - sent){
+			len = BENCH_QUEUE_BYTES - sent;
+		}
+		if(size & 1){
+			uint8_t *span;
+			n = shell_queue_reserve_span(&stress_queue, &span);
+			n = (n < len) ? n : len;
+			for(size_t i = 0; i < n; i++){
+				span[i] = next++;
+			}
+			shell_queue_commit(&stress_queue, n);
+		}else{
+			for(size_t i = 0; i < len; i++){
+				data[i] = (uint8_t)(next + i);
+			}
+			n = shell_queue_in_bulk(&stress_queue, data, len);
+			next += n;
+		}
+		if(n == 0){
+			/* queue full, the consumer may share the core */
+			sched_yield();
+		}
+		sent += n;
+		size++;
+	}
+	return NULL;
+}
+
+/**
+  * @brief  		runs the stress test of the queue
+  * @retval 		number of bytes received out of sequence, 0 if the queue is right
+  */
+static size_t stress_consumer(void)
+{
+	uint8_t data[BENCH_QUEUE_LENGTH];
+	size_t received = 0;
+	size_t errors = 0;
+	size_t size = 0;
+	uint8_t expected = 0;
+
+	while(received < BENCH_QUEUE_BYTES){
+		size_t len = (size * 7) % BENCH_QUEUE_LENGTH + 1;
+		const uint8_t *got;
+		size_t n;
+
+		if(size & 1){
+			uint8_t *span;
+			n = shell_queue_peek_span(&stress_queue, &span);
+			n = (n < len) ? n : len;
+			got = span;
+		}else{
+			n = shell_queue_out_bulk(&stress_queue, data, len);
+			got = data;
+		}
+		for(size_t i = 0; i < n; i++){
+			errors += (got[i] != expected++);
+		}
+		if(size & 1){
+			shell_queue_release(&stress_queue, n);
+		}
+		if(n == 0){
+			sched_yield();
+		}
+		received += n;
+		size++;
+	}
+	return errors;
+}
+
+/*
+ * The queue of the baseline, before its rework into a lock-free ring, copied to measure the
+ * change: its indexes wrap with %, and each byte is a call testing for full or empty.
+ */
+typedef struct {
+	size_t		Front;
+	size_t		Rear;
+	uint8_t		PBase[BENCH_QUEUE_LENGTH];
+} baseline_queue_s;
+
+/* not inlined, as the queue was built in sys_queue.c */
+static __attribute__((noinline)) uint8_t baseline_queue_in(baseline_queue_s *queue, uint8_t *PData)
+{
+	if(((queue->Rear + 1) % BENCH_QUEUE_LENGTH) == queue->Front){
+		return false;
+	}
+	queue->PBase[queue->Rear] = *PData;
+	queue->Rear = (queue->Rear + 1) % BENCH_QUEUE_LENGTH;
+	return true;
+}
+
+static __attribute__((noinline)) uint8_t baseline_queue_out(baseline_queue_s *queue, uint8_t *PData)
+{
+	if(queue->Front == queue->Rear){
+		return false;
+	}
+	*PData = queue->PBase[queue->Front];
+	queue->Front = (queue->Front + 1) % BENCH_QUEUE_LENGTH;
+	return true;
+}
+
+/**
+  * @brief  		throughput of the baseline queue, as bench_queue_pass a byte at a time
+  */
+static bench_time_s bench_queue_baseline(void)
+{
+	baseline_queue_s queue = { 0 };
+	uint8_t in[BENCH_QUEUE_CHUNK];
+	uint8_t out[BENCH_QUEUE_CHUNK];
+	volatile uint8_t sum = 0;
+	bench_time_s t;
+
+	for(size_t i = 0; i < sizeof(in); i++){
+		in[i] = (uint8_t)i;
+	}
+	t = bench_now();
+	for(size_t done = 0; done < BENCH_QUEUE_BYTES; done += BENCH_QUEUE_CHUNK){
+		for(size_t i = 0; i < sizeof(in); i++){
+			baseline_queue_in(&queue, &in[i]);
+		}
+		for(size_t i = 0; i < sizeof(out); i++){
+			baseline_queue_out(&queue, &out[i]);
+		}
+		sum += out[done % BENCH_QUEUE_CHUNK];
+	}
+	return bench_since(t);
+}
+
+/**
+  * @brief  		throughput of the queue, written then read BENCH_QUEUE_CHUNK bytes at
+  * 				a time, a byte at a time (shell_queue_in/out) or in bulk
+  * @param  bulk:	use shell_queue_in_bulk/out_bulk
+  */
+static bench_time_s bench_queue_pass(shell_queue_s *queue, bool bulk)
+{
+	uint8_t in[BENCH_QUEUE_CHUNK];
+	uint8_t out[BENCH_QUEUE_CHUNK];
+	volatile uint8_t sum = 0;
+	bench_time_s t;
+
+	for(size_t i = 0; i < sizeof(in); i++){
+		in[i] = (uint8_t)i;
+	}
+	t = bench_now();
+	for(size_t done = 0; done < BENCH_QUEUE_BYTES; done += BENCH_QUEUE_CHUNK){
+		if(bulk){
+			shell_queue_in_bulk(queue, in, sizeof(in));
+			shell_queue_out_bulk(queue, out, sizeof(out));
+		}else{
+			for(size_t i = 0; i < sizeof(in); i++){
+				shell_queue_in(queue, &in[i]);
+			}
+			for(size_t i = 0; i < sizeof(out); i++){
+				shell_queue_out(queue, &out[i]);
+			}
+		}
+		sum += out[done % BENCH_QUEUE_CHUNK];
+	}
+	return bench_since(t);
+}
+
+/**
+  * @brief  		throughput of the queue and stress test with two threads
+  * @retval 		true if the stress test passed
+  */
+static bool bench_queue(FILE *out)
+{
+	shell_queue_s queue;
+	uint8_t pool[BENCH_QUEUE_LENGTH];
+	pthread_t producer;
+	bench_time_s t;
+	size_t errors;
+
+	SHELL_QUEUE_INIT(&queue, pool);
+	fprintf(out, "  \"queue\": {\"bytes\": %lu, \"length\": %u, \"chunk\": %u, ",
+			BENCH_QUEUE_BYTES, BENCH_QUEUE_LENGTH, BENCH_QUEUE_CHUNK);
+	print_time(out, "baseline", bench_queue_baseline(), BENCH_QUEUE_BYTES, "byte");
+	fprintf(out, ", ");
+	print_time(out, "bytewise", bench_queue_pass(&queue, false), BENCH_QUEUE_BYTES, "byte");
+	fprintf(out, ", ");
+	print_time(out, "bulk", bench_queue_pass(&queue, true), BENCH_QUEUE_BYTES, "byte");
+
+	SHELL_QUEUE_INIT(&stress_queue, stress_pool);
+	t = bench_now();
+	pthread_create(&producer, NULL, stress_producer, NULL);
+	errors = stress_consumer();
+	pthread_join(producer, NULL);
+	t = bench_since(t);
+	fprintf(out, ", \"stress_errors\": %lu, ", (unsigned long)errors);
+	print_time(out, "stress", t, BENCH_QUEUE_BYTES, "byte");
+	fprintf(out, "},\n");
+	return errors == 0;
+}
+
+static void bench_rx(FILE *out)
+{
+	/* plain typing, the line is erased by Ctrl+u before it is full */
+	static const char typing[] = "the quick brown fox jumps over the lazy dog\x15";
+	/* editing and escape sequences: arrows, Home, End, Ctrl+arrows, Delete, Backspace */
+	static const char editing[] = "abcdef\x1b[D\x1b[DXY\x7f\x1b[H\x1b[3~\x1b[F\x1b[1;5D\x1b[C\x15";
+	bench_time_s t;
+
+	t = bench_now();
+	bench_feed(typing, sizeof(typing) - 1, BENCH_RX_BYTES);
+	t = bench_since(t);
+	fprintf(out, "  \"rx\": {\"bytes\": %lu, \"chunk\": %u, \"bytes_per_s\": %.0f, ",
+			BENCH_RX_BYTES, (unsigned)cli_console.rx_buff.Mask + 1, BENCH_RX_BYTES * 1e9 / t.ns);
+	print_time(out, "typing", t, BENCH_RX_BYTES, "byte");
+
+	t = bench_now();
+	bench_feed(editing, sizeof(editing) - 1, BENCH_RX_BYTES);
+	t = bench_since(t);
+	fprintf(out, ", ");
+	print_time(out, "editing", t, BENCH_RX_BYTES, "byte");
+	fprintf(out, "},\n");
+
+	/* the decoder alone */
+	vt100_decoder_s decoder;
+	vt100_key_s key;
+	volatile uint8_t keys = 0;
+
+	vt100_decoder_init(&decoder);
+	t = bench_now();
+	for(size_t i = 0; i < BENCH_DECODE_BYTES; i++){
+		keys += vt100_decode(&decoder, editing[i % (sizeof(editing) - 1)], &key);
+	}
+	t = bench_since(t);
+	fprintf(out, "  \"decode\": {");
+	print_time(out, "decode", t, BENCH_DECODE_BYTES, "byte");
+	fprintf(out, "},\n");
+}
+
+/**
+  * @brief  		depth of the history (HISTORY_BUFF_LEN bytes, packed entries) against the
+  * 				length of the commands, compared to fixed slots of MAX_LINE_LEN bytes in the
+  * 				same memory, and cost of adding a command and of recalling one
+  */
+static void bench_history(FILE *out)
+{
+	static const uint8_t lengths[] = {4, 8, 16, 32, 64, MAX_LINE_LEN - 1};
+	static uint8_t pool[HISTORY_BUFF_LEN];
+	HISTORY_S history = { .buff = pool, .size = sizeof(pool) };
+	char command[MAX_LINE_LEN];
+
+	fprintf(out, "  \"history\": {\"bytes\": %u, \"fixed_slot_bytes\": %u, \"fixed_depth\": %u, \"packed\": [\n",
+			HISTORY_BUFF_LEN, MAX_LINE_LEN, HISTORY_BUFF_LEN / MAX_LINE_LEN);
+	for(size_t l = 0; l < sizeof(lengths); l++){
+		size_t depth = 0;
+		char *entry;
+		uint8_t len;
+
+		history.end = history.show = 0;
+		memset(command, 'x', lengths[l]);
+		command[lengths[l]] = '\0';
+		/* distinct commands, the history does not keep a repeated one */
+		bench_time_s add = bench_now();
+		for(size_t i = 0; i < BENCH_HISTORY_ADDS; i++){
+			memcpy(command, &(uint32_t){ (uint32_t)i | 0x01010101U }, (lengths[l] < 4) ? lengths[l] : 4);
+			cli_history_add(&history, command);
+		}
+		add = bench_since(add);
+
+		/* [up] until the oldest entry, the last one is shown again */
+		for(char *previous = NULL; !cli_history_show(&history, true, &entry, &len) && entry != previous; previous = entry){
+			depth++;
+		}
+		bench_time_s up = bench_now();
+		for(size_t i = 0; i < BENCH_HISTORY_WALKS; i++){
+			history.show = history.end;
+			for(size_t j = 0; j < depth; j++){
+				cli_history_show(&history, true, &entry, &len);
+			}
+		}
+		up = bench_since(up);
+
+		fprintf(out, "    {\"command_len\": %u, \"depth\": %lu, \"fixed_bytes_same_depth\": %lu, ",
+				lengths[l], (unsigned long)depth, (unsigned long)depth * MAX_LINE_LEN);
+		print_time(out, "add", add, BENCH_HISTORY_ADDS, "command");
+		fprintf(out, ", ");
+		print_time(out, "up", up, BENCH_HISTORY_WALKS * depth, "step");
+		fprintf(out, "}%s\n", (l + 1 < sizeof(lengths)) ? "," : "");
+	}
+	fprintf(out, "  ]},\n");
+}
+
+static void bench_dispatch(FILE *out)
+{
+	static const size_t sizes[] = {16, 64, 256, 1024};
+	char line[16];
+
+	fprintf(out, "  \"dispatch\": [\n");
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+		while(cli_commands_nb < sizes[s]){
+			sprintf(names[cli_commands_nb], "c%04u", (unsigned)cli_commands_nb);
+			cli_add_command(names[cli_commands_nb], "", nop);
+		}
+
+		volatile uintptr_t found = 0;
+		bench_time_s hit = bench_now();
+		for(size_t i = 0; i < BENCH_LOOKUPS; i++){
+			found += (uintptr_t)cli_command_find(names[(i * 7919) % sizes[s]]);
+		}
+		hit = bench_since(hit);
+
+		bench_time_s miss = bench_now();
+		for(size_t i = 0; i < BENCH_LOOKUPS; i++){
+			found += (uintptr_t)cli_command_find("c9999");
+		}
+		miss = bench_since(miss);
+
+		/* the whole line: reception, decoding, parsing, lookup, execution and new prompt */
+		bench_time_s exec = bench_now();
+		for(size_t i = 0; i < BENCH_EXECS; i++){
+			size_t len = sprintf(line, "%s\r", names[(i * 7919) % sizes[s]]);
+			hal_linux_uart_receive((const uint8_t *)line, len);
+			cli_run();
+		}
+		exec = bench_since(exec);
+
+		fprintf(out, "    {\"commands\": %lu, ", (unsigned long)sizes[s]);
+		print_time(out, "hit", hit, BENCH_LOOKUPS, "lookup");
+		fprintf(out, ", ");
+		print_time(out, "miss", miss, BENCH_LOOKUPS, "lookup");
+		fprintf(out, ", ");
+		print_time(out, "line", exec, BENCH_EXECS, "line");
+		fprintf(out, "}%s\n", (s + 1 < sizeof(sizes) / sizeof(sizes[0])) ? "," : "");
+	}
+	fprintf(out, "  ],\n");
+}
+
+static void bench_wire_bytes(FILE *out)
+{
+	static const char pasted[] = "0123456789abcdef0123456789abcdef";
+
+	fprintf(out, "  \"wire_bytes\": {");
+	bench_wire("\x15" "0123456789012345678901234567890123456789");
+	fprintf(out, "\"char_at_end\": %lu, ", (unsigned long)bench_wire("x"));
+	bench_wire("\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D"
+				"\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D");
+	fprintf(out, "\"char_in_middle\": %lu, ", (unsigned long)bench_wire("y"));
+	fprintf(out, "\"backspace_in_middle\": %lu, ", (unsigned long)bench_wire("\x7f"));
+	fprintf(out, "\"cursor_left\": %lu, ", (unsigned long)bench_wire("\x1b[D"));
+	fprintf(out, "\"home\": %lu, ", (unsigned long)bench_wire("\x1b[H"));
+	fprintf(out, "\"end\": %lu, ", (unsigned long)bench_wire("\x1b[F"));
+	fprintf(out, "\"kill_line\": %lu, ", (unsigned long)bench_wire("\x15"));
+	fprintf(out, "\"paste_32\": %lu, ", (unsigned long)bench_wire(pasted));
+	bench_wire("\x15" "c0001 a short one\r");
+	bench_wire("c0002 with a few more arguments than the other one\r");
+	fprintf(out, "\"history_up\": %lu, ", (unsigned long)bench_wire("\x1b[A"));
+	fprintf(out, "\"history_up_shorter\": %lu, ", (unsigned long)bench_wire("\x1b[A"));
+	fprintf(out, "\"history_down_longer\": %lu", (unsigned long)bench_wire("\x1b[B"));
+	bench_wire("\x15");
+	fprintf(out, "},\n");
+}
+
+#define BENCH_LOG(name, cat)															\
+	do {																				\
+		bench_time_s t = {0, 0};														\
+		for(size_t i = 0; i < BENCH_LOGS; i += BENCH_LOG_BATCH){						\
+			bench_time_s start = bench_now();											\
+			for(size_t j = 0; j < BENCH_LOG_BATCH; j++){								\
+				LOG(cat, "value %u of %u\n", (unsigned)(i + j), (unsigned)BENCH_LOGS);	\
+				__asm__ volatile("" ::: "memory");										\
+			}																			\
+			start = bench_since(start);													\
+			t.ns += start.ns;															\
+			t.tsc += start.tsc;															\
+			cli_run();																	\
+		}																				\
+		print_time(out, name, t, BENCH_LOGS, "log");									\
+	} while(0)
+
+static void bench_log(FILE *out)
+{
+	/* the clock reads of each batch are counted in the cost of its LOGs */
+	fprintf(out, "  \"log\": {");
+	BENCH_LOG("printed", CLI_LOG_BENCH);
+	fprintf(out, ", ");
+	BENCH_LOG("disabled", CLI_LOG_OFF);
+	fprintf(out, ", ");
+	BENCH_LOG("rate_limited", CLI_LOG_LIMITED);
+	fprintf(out, ", ");
+	BENCH_LOG("compiled_out", CLI_LOG_MASKED);
+	fprintf(out, "}\n");
+}
+
+int main(void)
+{
+	/* stdout is redirected to the UART, the results are printed on the original one */
+	FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+
+	if(out == NULL || hal_linux_uart_init_local(&huart1, sink) != 0){
+		perror("bench");
+		return EXIT_FAILURE;
+	}
+	CLI_INIT(&huart1);
+	cli_log_stat |= 1 << CLI_LOG_BENCH;
+
+	fprintf(out, "{\n  \"config\": {\"rx_dma\": %s, \"tx_dma\": %s, \"log_deferred\": %s, \"timestamp\": %s, "
+			"\"latency\": %s, \"rx_queue\": %u, \"tx_buff\": %u},\n",
+#ifdef CLI_RX_DMA
+			"true",
+#else
+			"false",
+#endif
+#ifdef CLI_TX_DMA
+			"true",
+#else
+			"false",
+#endif
+#ifdef CLI_LOG_DEFERRED
+			"true",
+#else
+			"false",
+#endif
+#ifdef CLI_TIMESTAMP
+			"true",
+#else
+			"false",
+#endif
+#ifdef CLI_LATENCY
+			"true",
+#else
+			"false",
+#endif
+			(unsigned)cli_console.rx_buff.Mask + 1, CLI_TX_BUFF_LENGTH);
+
+	bool queue_ok = bench_queue(out);
+	bench_rx(out);
+	bench_wire_bytes(out);
+	bench_history(out);
+	bench_dispatch(out);
+	bench_log(out);
+	fprintf(out, "}\n");
+	fclose(out);
+	/* the stress test of the queue failing makes the other results meaningless */
+	return queue_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
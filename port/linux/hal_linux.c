@@ -0,0 +1,423 @@
+/*
+ * hal_linux.c
+ *
+ *  Linux stand-in for the STM32 HAL UART. The UART is the master side of a
+ *  pseudo-terminal: connect to the slave side with screen or picocom, or open it from a
+ *  test. Two threads stand for the interrupts of the UART:
+ *  - the reception thread reads the bytes written to the terminal and hands them out at
+ *    the baud rate, calling HAL_UART_RxCpltCallback (HAL_UART_Receive_IT) or
+ *    HAL_UARTEx_RxEventCallback (HAL_UARTEx_ReceiveToIdle_DMA, circular buffer),
+ *  - the transmission thread writes the transfers to the terminal at the baud rate and
+ *    calls HAL_UART_TxCpltCallback.
+ *  They only call the callbacks while holding the interrupt mask, as interrupts of the
+ *  same priority they do not preempt each other.
+ *  Without terminal (hal_linux_uart_init_local), the bytes received are given by
+ *  hal_linux_uart_receive and the transfers are completed at once, to a sink.
+ *
+ *  gcc -std=gnu11 -O2 -Iport/linux -Iinc port/linux/main.c port/linux/hal_linux.c \
+ *      src/sys_command_line.c src/sys_queue.c src/vt100.c src/cli_os.c -lpthread -o ushell
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "main.h"
+
+#define UART_VECTOR		(16 + 37)		/* VECTACTIVE of the UART interrupt, as USART1 */
+
+int _write(int file, char *data, int len);
+
+__thread SCB_Type	hal_linux_scb;
+uint32_t			SystemCoreClock		= 1000000000U;
+
+static pthread_mutex_t	irq_mutex		= PTHREAD_MUTEX_INITIALIZER;	/* held while PRIMASK is set */
+static __thread uint32_t primask		= 0;
+
+static struct {
+	UART_HandleTypeDef	*huart;
+	int					master;			/* pseudo-terminal, UART side */
+	int					slave;			/* kept open so that the master does not hang up */
+	char				name[64];
+	uint32_t			byte_us;		/* time of a byte on the link */
+	uint32_t			latency_us;
+	void				(*sink)(const uint8_t *data, uint16_t len);	/* local mode: receives the transfers */
+
+	pthread_mutex_t		lock;			/* protects the transfers, taken after irq_mutex */
+	pthread_cond_t		tx_cond;
+	const uint8_t		*tx_data;
+	uint16_t			tx_len;			/* 0 when no transmission is in progress */
+	uint8_t				*rx_data;
+	uint16_t			rx_size;		/* 0 when the reception is not armed */
+	uint16_t			rx_pos;			/* circular mode: position of the DMA in rx_data */
+	bool				rx_circular;
+} uart = {
+	.master = -1,
+	.slave = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.tx_cond = PTHREAD_COND_INITIALIZER,
+};
+
+/*******************************************************************************
+ *
+ * 	CMSIS
+ *
+ ******************************************************************************/
+
+uint32_t __get_PRIMASK(void)
+{
+	return primask;
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+	if(priMask && !primask){
+		pthread_mutex_lock(&irq_mutex);
+	}else if(!priMask && primask){
+		pthread_mutex_unlock(&irq_mutex);
+	}
+	primask = priMask;
+}
+
+void __disable_irq(void)
+{
+	__set_PRIMASK(1);
+}
+
+void __enable_irq(void)
+{
+	__set_PRIMASK(0);
+}
+
+/**
+  * @brief  enters the UART interrupt, from one of the interrupt threads
+  */
+static void irq_enter(void)
+{
+	pthread_mutex_lock(&irq_mutex);
+	primask = 1;
+	hal_linux_scb.ICSR = UART_VECTOR;
+}
+
+static void irq_exit(void)
+{
+	hal_linux_scb.ICSR = 0;
+	primask = 0;
+	pthread_mutex_unlock(&irq_mutex);
+}
+
+/*******************************************************************************
+ *
+ * 	HAL
+ *
+ ******************************************************************************/
+
+static uint64_t monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000;
+}
+
+uint32_t hal_linux_micros(void)
+{
+	return (uint32_t)monotonic_us();
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return (uint32_t)(monotonic_us() / 1000);
+}
+
+void HAL_NVIC_SystemReset(void)
+{
+	fflush(stdout);
+	exit(EXIT_SUCCESS);
+}
+
+void HAL_UART_MspInit(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	if(huart != uart.huart || Size == 0){
+		return HAL_ERROR;
+	}
+
+	pthread_mutex_lock(&uart.lock);
+	uart.rx_data = pData;
+	uart.rx_size = Size;
+	uart.rx_pos = 0;
+	uart.rx_circular = false;
+	pthread_mutex_unlock(&uart.lock);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	HAL_StatusTypeDef status = HAL_UART_Receive_IT(huart, pData, Size);
+
+	uart.rx_circular = true;
+	return status;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size)
+{
+	if(huart != uart.huart || Size == 0){
+		return HAL_ERROR;
+	}
+
+	if(uart.sink != NULL){
+		/* completed at once, the callback restarts the next transfer if there is one */
+		uart.sink(pData, Size);
+		HAL_UART_TxCpltCallback(huart);
+		return HAL_OK;
+	}
+
+	pthread_mutex_lock(&uart.lock);
+	if(uart.tx_len != 0){
+		pthread_mutex_unlock(&uart.lock);
+		return HAL_BUSY;
+	}
+	uart.tx_data = pData;
+	uart.tx_len = Size;
+	pthread_cond_signal(&uart.tx_cond);
+	pthread_mutex_unlock(&uart.lock);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size)
+{
+	return HAL_UART_Transmit_IT(huart, pData, Size);
+}
+
+/* default callbacks, overridden by the application as with the HAL */
+__attribute__((weak)) void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+__attribute__((weak)) void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+__attribute__((weak)) void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+	(void)huart;
+	(void)Size;
+}
+
+__attribute__((weak)) void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+/*******************************************************************************
+ *
+ * 	Interrupt threads
+ *
+ ******************************************************************************/
+
+/**
+  * @brief  hands a received byte to the UART, in the reception interrupt
+  * @param  c: byte
+  * @param  idle: no other byte follows it, the line becomes idle
+  */
+static void uart_rx_byte(uint8_t c, bool idle)
+{
+	uint16_t event = 0;		/* circular mode: Size of HAL_UARTEx_RxEventCallback, 0 if none */
+	bool complete = false;
+
+	irq_enter();
+	pthread_mutex_lock(&uart.lock);
+	if(uart.rx_size == 0){
+		/* nothing armed: the byte overwrites the previous one */
+		uart.huart->ErrorCode |= HAL_UART_ERROR_ORE;
+	}else if(uart.rx_circular){
+		uart.rx_data[uart.rx_pos++] = c;
+		if(uart.rx_pos == uart.rx_size || uart.rx_pos == uart.rx_size / 2 || idle){
+			event = uart.rx_pos;
+		}
+		if(uart.rx_pos == uart.rx_size){
+			uart.rx_pos = 0;
+		}
+	}else{
+		uart.rx_data[uart.rx_pos++] = c;
+		if(uart.rx_pos == uart.rx_size){
+			uart.rx_size = 0;
+			complete = true;
+		}
+	}
+	pthread_mutex_unlock(&uart.lock);
+
+	if(complete){
+		HAL_UART_RxCpltCallback(uart.huart);
+	}else if(event != 0){
+		HAL_UARTEx_RxEventCallback(uart.huart, event);
+	}
+	irq_exit();
+}
+
+static void *uart_rx_thread(void *arg)
+{
+	uint8_t buff[256];
+	(void)arg;
+
+	for(;;){
+		struct pollfd pfd = { .fd = uart.master, .events = POLLIN };
+		if(poll(&pfd, 1, -1) < 0){
+			continue;
+		}
+		ssize_t n = read(uart.master, buff, sizeof(buff));
+		if(n <= 0){
+			usleep(10000);
+			continue;
+		}
+
+		for(ssize_t i = 0; i < n; i++){
+			/* the byte arrives once it is fully on the line */
+			if(uart.byte_us + uart.latency_us != 0){
+				usleep(uart.byte_us + uart.latency_us);
+			}
+			uart_rx_byte(buff[i], i == n - 1);
+		}
+	}
+	return NULL;
+}
+
+static void *uart_tx_thread(void *arg)
+{
+	(void)arg;
+
+	for(;;){
+		pthread_mutex_lock(&uart.lock);
+		while(uart.tx_len == 0){
+			pthread_cond_wait(&uart.tx_cond, &uart.lock);
+		}
+		const uint8_t *data = uart.tx_data;
+		uint16_t len = uart.tx_len;
+		pthread_mutex_unlock(&uart.lock);
+
+		/* the data stays valid until the transfer is completed */
+		for(uint16_t done = 0; done < len; ){
+			ssize_t n = write(uart.master, &data[done], len - done);
+			if(n < 0 && errno != EINTR && errno != EAGAIN){
+				break;
+			}
+			done += (n > 0) ? n : 0;
+		}
+		if(uart.byte_us != 0){
+			usleep(uart.byte_us * len);
+		}
+
+		irq_enter();
+		pthread_mutex_lock(&uart.lock);
+		uart.tx_len = 0;
+		pthread_mutex_unlock(&uart.lock);
+		HAL_UART_TxCpltCallback(uart.huart);
+		irq_exit();
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+ *
+ * 	Port
+ *
+ ******************************************************************************/
+
+static ssize_t stdio_write(void *cookie, const char *data, size_t len)
+{
+	return _write((int)(intptr_t)cookie, (char *)data, (int)len);
+}
+
+/**
+  * @brief  makes printf go through _write as with newlib
+  * @retval 0, -1 on error
+  */
+static int stdio_redirect(void)
+{
+	cookie_io_functions_t io = { .write = stdio_write };
+
+	stdout = fopencookie((void *)(intptr_t)STDOUT_FILENO, "w", io);
+	stderr = fopencookie((void *)(intptr_t)STDERR_FILENO, "w", io);
+	if(stdout == NULL || stderr == NULL){
+		return -1;
+	}
+	setvbuf(stderr, NULL, _IONBF, 0);
+	return 0;
+}
+
+int hal_linux_uart_init(UART_HandleTypeDef *huart, uint32_t baud, uint32_t latency_us, const char *link)
+{
+	struct termios tio;
+	pthread_t thread;
+
+	uart.huart = huart;
+	uart.byte_us = (baud != 0) ? 10000000U / baud : 0;
+	uart.latency_us = latency_us;
+
+	uart.master = posix_openpt(O_RDWR | O_NOCTTY);
+	if(uart.master < 0 || grantpt(uart.master) != 0 || unlockpt(uart.master) != 0
+			|| ptsname_r(uart.master, uart.name, sizeof(uart.name)) != 0){
+		return -1;
+	}
+
+	/* raw terminal, the line discipline must not echo or translate anything */
+	uart.slave = open(uart.name, O_RDWR | O_NOCTTY);
+	if(uart.slave < 0 || tcgetattr(uart.slave, &tio) != 0){
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(uart.slave, TCSANOW, &tio);
+
+	if(link != NULL){
+		unlink(link);
+		if(symlink(uart.name, link) != 0){
+			return -1;
+		}
+	}
+
+	if(stdio_redirect() != 0){
+		return -1;
+	}
+
+	if(pthread_create(&thread, NULL, uart_rx_thread, NULL) != 0
+			|| pthread_create(&thread, NULL, uart_tx_thread, NULL) != 0){
+		return -1;
+	}
+	return 0;
+}
+
+int hal_linux_uart_init_local(UART_HandleTypeDef *huart, void (*sink)(const uint8_t *data, uint16_t len))
+{
+	uart.huart = huart;
+	uart.sink = sink;
+	strcpy(uart.name, "local");
+
+	return stdio_redirect();
+}
+
+void hal_linux_uart_receive(const uint8_t *data, size_t len)
+{
+	for(size_t i = 0; i < len; i++){
+		uart_rx_byte(data[i], i == len - 1);
+	}
+}
+
+const char *hal_linux_uart_name(void)
+{
+	return uart.name;
+}
@@ -0,0 +1,177 @@
+/*
+ * main.c
+ *
+ *  Runs the shell on Linux, on a pseudo-terminal standing for the UART.
+ *
+ *  ./ushell [-b baud] [-l latency_us] [-L link] [-p period_us] [-s]
+ *
+ *  -b	baud rate of the stand-in UART, 0 for no limit (default 115200)
+ *  -l	latency added before each received byte is handed to the shell, in us (default 0)
+ *  -L	symbolic link to create to the terminal, e.g. /tmp/ushell
+ *  -p	period of the main loop calling cli_run, in us (default 1000)
+ *  -s	serves a second shell, with its own context, on the standard input and output of
+ *  	the process. They are used as they are: run it from a raw terminal, e.g.
+ *  	socat -,raw,echo=0 EXEC:"./ushell -s"
+ *
+ *  Built with -DCLI_OS=CLI_OS_POSIX, the shell runs in cli_task instead: it sleeps until
+ *  a byte is received and -p is ignored. The second shell of -s is then started by
+ *  cli_task_setup, in the shell task.
+ *
+ *  The name of the terminal is printed on the standard error, connect to it with e.g.
+ *  "picocom /dev/pts/3" or "screen /dev/pts/3".
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "main.h"
+#include "sys_command_line.h"
+
+UART_HandleTypeDef huart1;
+
+/* second shell (-s), on the standard input and output: small buffers are enough */
+CLI_CTX_DEFINE(cli_stdio, 64, 512, 256);
+static bool stdio_shell = false;
+
+/**
+  * @brief  transmission of the second shell, written at once
+  */
+static int stdio_transmit(cli_ctx_s *ctx, const uint8_t *data, uint16_t len)
+{
+	while(len > 0){
+		ssize_t n = write(STDOUT_FILENO, data, len);
+		if(n <= 0){
+			/* standard output closed, what is left is dropped */
+			break;
+		}
+		data += n;
+		len -= n;
+	}
+	cli_ctx_tx_done(ctx);
+	return 0;
+}
+
+/**
+  * @brief  reception of the second shell, stands for its interrupt
+  */
+static void *stdio_rx_thread(void *arg)
+{
+	uint8_t data[64];
+	ssize_t n;
+
+	(void)arg;
+	while((n = read(STDIN_FILENO, data, sizeof(data))) > 0){
+		__disable_irq();
+		cli_ctx_receive(&cli_stdio, data, n);
+		__enable_irq();
+	}
+	return NULL;
+}
+
+/**
+  * @brief  starts the second shell, once cli_init is done
+  */
+static void stdio_shell_start(void)
+{
+	pthread_t thread;
+
+	cli_ctx_add(&cli_stdio, stdio_transmit, NULL);
+	pthread_create(&thread, NULL, stdio_rx_thread, NULL);
+}
+
+#if CLI_OS == CLI_OS_POSIX
+/**
+  * @brief  starts the second shell from the shell task, once cli_task has done cli_init
+  */
+void cli_task_setup(void)
+{
+	if(stdio_shell){
+		stdio_shell_start();
+	}
+}
+#endif
+
+uint8_t echo(int argc, char *argv[]);
+CLI_COMMAND(echo, "prints its arguments", echo);
+
+uint8_t echo(int argc, char *argv[])
+{
+	for(int i = 1; i < argc; i++){
+		printf("%s%s", argv[i], (i < argc - 1) ? " " : "");
+	}
+	NL1();
+	return EXIT_SUCCESS;
+}
+
+uint8_t count(int argc, char *argv[]);
+CLI_COMMAND(count, "counts up to n, one per period: \"count n [period_ms]\" (Ctrl-C stops it)", count);
+
+uint8_t count(int argc, char *argv[])
+{
+	static unsigned long i;
+	static uint32_t last;
+
+	if(argc < 2){
+		printf("usage: count n [period_ms]");NL1();
+		return EXIT_FAILURE;
+	}
+	uint32_t period = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1000;
+
+	CLI_PT_BEGIN();
+	for(i = 1; i <= strtoul(argv[1], NULL, 0) && !CLI_CANCELLED(); i++){
+		printf("%lu", i);NL1();
+		last = HAL_GetTick();
+		CLI_PT_WAIT_UNTIL(HAL_GetTick() - last >= period);
+	}
+	CLI_PT_END(CLI_CANCELLED() ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t baud = 115200;
+	uint32_t latency_us = 0;
+	uint32_t period_us = 1000;
+	const char *link = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "b:l:L:p:s")) != -1){
+		switch(opt){
+		case 'b': baud = strtoul(optarg, NULL, 0); break;
+		case 'l': latency_us = strtoul(optarg, NULL, 0); break;
+		case 'L': link = optarg; break;
+		case 'p': period_us = strtoul(optarg, NULL, 0); break;
+		case 's': stdio_shell = true; break;
+		default:
+			fprintf(stderr, "usage: %s [-b baud] [-l latency_us] [-L link] [-p period_us] [-s]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* stderr is redirected to the terminal too, the name is printed before */
+	FILE *console = fdopen(dup(STDERR_FILENO), "w");
+
+	if(hal_linux_uart_init(&huart1, baud, latency_us, link) != 0){
+		perror("hal_linux_uart_init");
+		return EXIT_FAILURE;
+	}
+	fprintf(console, "UART on %s, %lu baud\n", hal_linux_uart_name(), (unsigned long)baud);
+	fclose(console);
+
+#if CLI_OS == CLI_OS_POSIX
+	(void)period_us;
+	cli_task(&huart1);
+#else
+	CLI_INIT(&huart1);
+	if(stdio_shell){
+		stdio_shell_start();
+	}
+
+	for(;;){
+		CLI_RUN();
+		usleep(period_us);
+	}
+#endif
+}
@@ -0,0 +1,115 @@
+/*
+ * main.h
+ *
+ *  Linux stand-in for the parts of the STM32 HAL and CMSIS used by the shell, so that the
+ *  unmodified shell sources build and run on a host. The UART is a pseudo-terminal and its
+ *  interrupts are raised by threads (see hal_linux.c).
+ */
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * HAL
+ */
+typedef enum {
+	HAL_OK			= 0x00U,
+	HAL_ERROR		= 0x01U,
+	HAL_BUSY		= 0x02U,
+	HAL_TIMEOUT		= 0x03U
+} HAL_StatusTypeDef;
+
+#define HAL_UART_ERROR_NONE		0x00000000U
+#define HAL_UART_ERROR_PE		0x00000001U
+#define HAL_UART_ERROR_NE		0x00000002U
+#define HAL_UART_ERROR_FE		0x00000004U
+#define HAL_UART_ERROR_ORE		0x00000008U
+#define HAL_UART_ERROR_DMA		0x00000010U
+
+typedef struct {
+	void				*Instance;		/* unused */
+	volatile uint32_t	ErrorCode;		/* HAL_UART_ERROR_xxx */
+} UART_HandleTypeDef;
+
+uint32_t			HAL_GetTick(void);
+void				HAL_NVIC_SystemReset(void);
+void				HAL_UART_MspInit(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef	HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef	HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef	HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef	HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+
+/* callbacks, implemented by the application (the shell) */
+void				HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
+void				HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void				HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size);
+void				HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+
+/*
+ * CMSIS
+ * The interrupt mask is a mutex shared with the interrupt threads, taken while PRIMASK is
+ * set. SCB->ICSR is per thread: VECTACTIVE is only set in the interrupt threads.
+ */
+typedef struct {
+	volatile uint32_t	ICSR;
+} SCB_Type;
+
+#define SCB_ICSR_VECTACTIVE_Msk		0x1FFU
+
+extern __thread SCB_Type	hal_linux_scb;
+#define SCB					(&hal_linux_scb)
+
+extern uint32_t SystemCoreClock;
+
+uint32_t			__get_PRIMASK(void);
+void				__set_PRIMASK(uint32_t priMask);
+void				__disable_irq(void);
+void				__enable_irq(void);
+
+/* no cycle counter: the timestamps are in microseconds */
+#define CLI_TIMESTAMP_GET()		hal_linux_micros()
+#define CLI_TIMESTAMP_FREQ		1000000U
+
+/*
+ * Port
+ */
+
+/**
+  * @brief  			opens the pseudo-terminal standing for the UART and starts its interrupt
+  * 					threads. stdout and stderr are redirected to _write, as with newlib.
+  * @param  huart:		handle given to the shell
+  * @param  baud:		baud rate of the link (10 bits per byte), 0 for no limit
+  * @param  latency_us:	delay added before the reception interrupt of each byte
+  * @param  link:		path of a symbolic link to create to the terminal, can be NULL
+  * @retval 			0, -1 on error (errno is set)
+  */
+int					hal_linux_uart_init(UART_HandleTypeDef *huart, uint32_t baud, uint32_t latency_us, const char *link);
+
+/**
+  * @brief  			sets the UART up without terminal nor threads, e.g. for tests and benchmarks.
+  * 					stdout and stderr are redirected to _write.
+  * @param  huart:		handle given to the shell
+  * @param  sink:		called with the data of each transfer, completed at once
+  * @retval 			0, -1 on error
+  */
+int					hal_linux_uart_init_local(UART_HandleTypeDef *huart, void (*sink)(const uint8_t *data, uint16_t len));
+
+/**
+  * @brief  			local mode: receives bytes, one reception interrupt each
+  */
+void				hal_linux_uart_receive(const uint8_t *data, size_t len);
+
+/**
+  * @brief  			name of the terminal to connect to (e.g. /dev/pts/3)
+  */
+const char			*hal_linux_uart_name(void);
+
+/**
+  * @brief  			free-running microseconds counter
+  */
+uint32_t			hal_linux_micros(void);
+
+#endif /* __MAIN_H */
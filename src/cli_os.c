@@ -0,0 +1,107 @@
+/*
+ * cli_os.c
+ *
+ *  Implementations of the operating system abstraction of the shell (see cli_os.h).
+ */
+
+#include "main.h"
+#include "../inc/cli_os.h"
+
+#if CLI_OS == CLI_OS_FREERTOS
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+static TaskHandle_t volatile cli_os_task = NULL;
+
+void cli_os_init(void)
+{
+	cli_os_task = xTaskGetCurrentTaskHandle();
+}
+
+void cli_os_signal(void)
+{
+	TaskHandle_t task = cli_os_task;
+
+	if(task == NULL){
+		return;
+	}
+	if(SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk){
+		BaseType_t woken = pdFALSE;
+		vTaskNotifyGiveFromISR(task, &woken);
+		portYIELD_FROM_ISR(woken);
+	}else{
+		xTaskNotifyGive(task);
+	}
+}
+
+void cli_os_wait(uint32_t timeout_ms)
+{
+	ulTaskNotifyTake(pdTRUE, (timeout_ms == CLI_OS_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms));
+}
+
+bool cli_os_in_task(void)
+{
+	return xTaskGetCurrentTaskHandle() == cli_os_task;
+}
+
+#elif CLI_OS == CLI_OS_POSIX
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+static pthread_mutex_t	cli_os_mutex	= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	cli_os_cond;
+static bool				cli_os_signaled	= false;
+static pthread_t		cli_os_thread;
+
+void cli_os_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cli_os_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	cli_os_thread = pthread_self();
+}
+
+void cli_os_signal(void)
+{
+	pthread_mutex_lock(&cli_os_mutex);
+	cli_os_signaled = true;
+	pthread_cond_signal(&cli_os_cond);
+	pthread_mutex_unlock(&cli_os_mutex);
+}
+
+void cli_os_wait(uint32_t timeout_ms)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if(deadline.tv_nsec >= 1000000000){
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&cli_os_mutex);
+	while(!cli_os_signaled){
+		if(timeout_ms == CLI_OS_FOREVER){
+			pthread_cond_wait(&cli_os_cond, &cli_os_mutex);
+		}else if(pthread_cond_timedwait(&cli_os_cond, &cli_os_mutex, &deadline) != 0){
+			break;
+		}
+	}
+	cli_os_signaled = false;
+	pthread_mutex_unlock(&cli_os_mutex);
+}
+
+bool cli_os_in_task(void)
+{
+	return pthread_equal(pthread_self(), cli_os_thread);
+}
+
+#endif /* CLI_OS */
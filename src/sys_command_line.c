@@ -16,8 +16,19 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio_ext.h>
 #include "../inc/sys_command_line.h"
 
+/*******************************************************************************
+ *
+ * 	Macros
+ *
+ ******************************************************************************/
+
+/* Masks the interrupts, restoring the previous state on exit so that they nest */
+#define CLI_ENTER_CRITICAL()	uint32_t cli_primask = __get_PRIMASK(); __disable_irq()
+#define CLI_EXIT_CRITICAL()		__set_PRIMASK(cli_primask)
+
 /*******************************************************************************
  *
  * 	Typedefs
@@ -25,32 +36,20 @@
  ******************************************************************************/
 
 
-/*
- * Buffer for current line
- */
-typedef struct {
-    uint8_t buff[MAX_LINE_LEN];
-    uint8_t len;
-} HANDLE_TYPE_S;
+#define HISTORY_NONE			0xFFFF
 
-/*
- * Command entry
- */
-typedef struct {
-    const char *pCmd;
-    const char *pHelp;
-    uint8_t (*pFun)(int argc, char *argv[]);
-} COMMAND_S;
+#define CLI_NOT_DONE(result)	((result) == CLI_RUNNING || (result) == CLI_WAITING)
 
 /*
- * Command line history
+ * Rate limit of a log category (token bucket)
  */
 typedef struct {
-    char cmd[HISTORY_MAX][MAX_LINE_LEN];
-    uint8_t count;
-    uint8_t latest;
-    uint8_t show;
-}HISTORY_S;
+	uint16_t rate;					/* LOGs per second, 0 for no limit */
+	uint16_t tokens;				/* LOGs that can be printed now */
+	uint32_t last;					/* tick of the last refill */
+	uint32_t suppressed;			/* LOGs suppressed and not reported yet */
+	uint32_t dropped;				/* LOGs suppressed since the init */
+}LOG_RATE_S;
 
 /*******************************************************************************
  *
@@ -58,11 +57,24 @@ typedef struct {
  *
  ******************************************************************************/
 
-unsigned char 			cBuffer;
-shell_queue_s 			cli_rx_buff; 				/* 64 bytes FIFO, saving commands from the terminal */
-UART_HandleTypeDef 		*huart_shell;
-COMMAND_S				CLI_commands[MAX_COMMAND_NB];
-static HISTORY_S 		history;
+CLI_CTX_DEFINE(cli_console, CLI_RX_LENGTH, CLI_TX_BUFF_LENGTH, HISTORY_BUFF_LEN);
+cli_ctx_s				*cli_ctx_current			= &cli_console;
+COMMAND_S				*CLI_commands				= NULL;	/* commands added at runtime, sorted by name, grown as they are added */
+size_t					cli_commands_nb				= 0;
+size_t					cli_commands_size			= 0;	/* number of entries allocated in CLI_commands */
+#if CLI_CMD_PROFILE
+static CMD_STATS_S		*cli_commands_stats			= NULL;	/* statistics of CLI_commands, in the same order */
+#endif
+#ifdef CLI_LOG_DEFERRED
+/* records of [category | nargs << 8][fmt][timestamp][args...] words */
+static uint8_t			cli_log_pool[CLI_LOG_RING_LENGTH * sizeof(uintptr_t)] __attribute__((aligned(sizeof(uintptr_t))));
+static shell_queue_s	cli_log_ring;
+volatile uint32_t		cli_log_dropped				= 0;	/* records lost because the ring was full */
+#endif
+static LOG_RATE_S		cli_log_rates[CLI_LAST_LOG_CATEGORY];
+#ifdef CLI_TIMESTAMP
+uint8_t					cli_timestamp_mode			= CLI_TIMESTAMP_MODE;
+#endif
 char *cli_logs_names[] = {"SHELL",
 #ifdef CLI_ADDITIONAL_LOG_CATEGORIES
 #define X(name, b) #name,
@@ -85,9 +97,43 @@ const char 				cli_reset_help[] 			= "reboot MCU";
 const char				cli_log_help[]				= "Controls which logs are displayed."
 													  "\n\t\"log show\" to show which logs are enabled"
 													  "\n\t\"log on/off all\" to enable/disable all logs"
-													  "\n\t\"log on/off [CAT1 CAT2 CAT...]\" to enable/disable the logs for categories [CAT1 CAT2 CAT...]";
-bool 					cli_password_ok 			= false;
-volatile bool			cli_tx_isr_flag				= false; /*< This flag is used internally so that _write will not write text in the console if the previous call is not over yet */
+													  "\n\t\"log on/off [CAT1 CAT2 CAT...]\" to enable/disable the logs for categories [CAT1 CAT2 CAT...]"
+													  "\n\t\"log rate CAT/all n\" to limit the logs of a category to n per second, 0 for no limit"
+													  "\n\t\"log time off/abs/rel\" to print no timestamp, the absolute time or the time since the previous log";
+const char				cli_stats_help[]			= "Shows the counters of the shell, to size its buffers."
+													  "\n\t\"stats reset\" to clear them";
+const char				cli_latency_help[]			= "Shows the histogram of the times from the reception of a byte to its echo."
+													  "\n\t\"latency reset\" to clear it";
+const char				cli_time_help[]				= "Runs a command and shows the time it took."
+													  "\n\t\"time <command> [args]\"";
+const char				cli_cmdstats_help[]			= "Shows the calls and execution times of the commands."
+													  "\n\t\"cmdstats reset\" to clear them";
+const char				cli_watch_help[]			= "Runs a command periodically and redraws its output in place, until a key is pressed."
+													  "\n\t\"watch [-n ms] <command> [args]\", every second by default";
+#if CLI_STDOUT_BUFFERING != _IONBF
+static char				cli_stdout_buff[CLI_STDOUT_BUFF_LENGTH];	/* stdio buffer of stdout */
+#endif
+
+#if CLI_WATCH
+/*
+ * Output of the command run by watch, redrawn in place at each run
+ */
+static struct {
+	cli_ctx_s	*ctx;							/* context watching, NULL if none is */
+	uint32_t	last;							/* tick of the last run */
+	uint16_t	len;							/* bytes in shown */
+	uint8_t		rows;							/* lines shown, the cursor is at the start of the row below them */
+	char		shown[CLI_WATCH_BUFF_LENGTH];	/* output displayed by the terminal */
+	char		next[CLI_WATCH_BUFF_LENGTH];	/* output of the current run */
+} watch;
+
+/* the text written by _write goes to buff instead of the terminal while it is not NULL */
+static struct {
+	char		*buff;
+	size_t		size;
+	size_t		len;
+} cli_capture;
+#endif
 
 /*******************************************************************************
  *
@@ -95,20 +141,117 @@ volatile bool			cli_tx_isr_flag				= false; /*< This flag is used internally so
  *
  ******************************************************************************/
 
-static void 	cli_history_add			(char* buff);
-static uint8_t 	cli_history_show		(uint8_t mode, char** p_history);
+static void 	cli_history_add			(HISTORY_S *history, char* buff);
+static uint8_t 	cli_history_show		(HISTORY_S *history, uint8_t mode, char** p_history, uint8_t *len);
+static uint16_t	cli_history_search		(const HISTORY_S *history, const char *pattern, uint8_t len, uint16_t from, uint8_t *at);
+static void		cli_search_run			(cli_ctx_s *ctx, uint16_t from);
+static uint8_t	cli_search_key			(cli_ctx_s *ctx, const vt100_key_s *key);
+static uint8_t	cli_search_render		(const cli_ctx_s *ctx, uint8_t *view, uint8_t *cursor);
+static cli_ctx_s *cli_ctx_find			(UART_HandleTypeDef *huart);
+static void		cli_ctx_start			(cli_ctx_s *ctx);
+static void		cli_ctx_select			(cli_ctx_s *ctx);
+static void		cli_ctx_run				(cli_ctx_s *ctx);
+#ifdef CLI_RX_DMA
+void 			HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size);
+#else
 void 			HAL_UART_RxCpltCallback	(UART_HandleTypeDef * huart);
-static void 	cli_rx_handle			(shell_queue_s *rx_buff);
-static void 	cli_tx_handle			(void);
+#endif
+static size_t	cli_rx_read				(cli_ctx_s *ctx, uint8_t *data, size_t max);
+static void 	cli_rx_handle			(cli_ctx_s *ctx);
+static void 	cli_exec_line			(cli_ctx_s *ctx, char *line);
+static void		cli_exec_result			(const char *command, uint8_t result);
+static void		cli_job_start			(cli_ctx_s *ctx, const char *line, int argc, char *argv[]);
+static void		cli_job_handle			(cli_ctx_s *ctx);
+static void 	cli_line_refresh		(cli_ctx_s *ctx);
+static size_t 	cli_line_complete		(HANDLE_TYPE_S *line, bool list);
+static size_t	cli_command_lower_bound	(bool declared, const char *name, size_t len);
+static size_t	cli_static_commands_nb	(void);
+static const COMMAND_S *cli_static_command(size_t i);
+static const COMMAND_S *cli_static_command_find(const char *name);
+static const COMMAND_S *cli_command_find(const char *name);
+static uint8_t	cli_command_exec		(const COMMAND_S *cmd, int argc, char *argv[]);
+static const char *cli_complete_candidate(int argc, char *argv[], size_t index);
+const char		*cli_help_complete		(int argc, char *argv[], size_t index);
+const char		*cli_log_complete		(int argc, char *argv[], size_t index);
+static void 	cli_line_clear			(HANDLE_TYPE_S *line);
+static void 	cli_line_insert			(HANDLE_TYPE_S *line, char c);
+static void 	cli_line_delete			(HANDLE_TYPE_S *line, uint8_t from, uint8_t to);
+static uint8_t 	cli_line_word_left		(HANDLE_TYPE_S *line);
+static uint8_t 	cli_line_word_right		(HANDLE_TYPE_S *line);
+static void 	cli_tx_handle			(cli_ctx_s *ctx);
+static void		cli_tx_start			(cli_ctx_s *ctx);
+static void		cli_rx_start			(cli_ctx_s *ctx);
+#ifdef CLI_LATENCY
+static void		cli_latency_handle		(cli_ctx_s *ctx);
+#endif
+#ifdef CLI_LOG_DEFERRED
+static void		cli_log_handle			(void);
+#endif
+static void		cli_log_refill			(LOG_RATE_S *limit, uint32_t now);
+static void		cli_log_report			(uint8_t cat, uint32_t suppressed);
+static void		cli_log_rate_handle		(void);
+static uint8_t	cli_log_rate_set		(const char *cat, uint16_t rate);
+void 			HAL_UART_TxCpltCallback	(UART_HandleTypeDef * huart);
 uint8_t 		cli_help				(int argc, char *argv[]);
 uint8_t 		cli_clear				(int argc, char *argv[]);
 uint8_t 		cli_reset				(int argc, char *argv[]);
 uint8_t 		cli_log					(int argc, char *argv[]);
+uint8_t 		cli_show_stats			(int argc, char *argv[]);
+#ifdef CLI_LATENCY
+uint8_t 		cli_show_latency		(int argc, char *argv[]);
+#endif
+const char		*cli_reset_complete		(int argc, char *argv[], size_t index);
+#if CLI_CMD_PROFILE
+uint8_t 		cli_time				(int argc, char *argv[]);
+const char		*cli_time_complete		(int argc, char *argv[], size_t index);
+uint8_t 		cli_cmdstats			(int argc, char *argv[]);
+#endif
+#if CLI_WATCH
+static void		cli_watch_draw			(void);
+uint8_t 		cli_watch				(int argc, char *argv[]);
+const char		*cli_watch_complete		(int argc, char *argv[], size_t index);
+#endif
 void 			cli_add_command			(const char *command, const char *help, uint8_t (*exec)(int argc, char *argv[]));
 void 			greet					(void);
 void 			cli_disable_log_entry	(char *str);
 void 			cli_enable_log_entry	(char *str);
 
+/*
+ * Shell builtin commands
+ */
+CLI_COMMAND_COMPLETE(help, cli_help_help, cli_help, cli_help_complete);
+CLI_COMMAND(cls, cli_clear_help, cli_clear);
+CLI_COMMAND(reset, cli_reset_help, cli_reset);
+CLI_COMMAND_COMPLETE(log, cli_log_help, cli_log, cli_log_complete);
+CLI_COMMAND_COMPLETE(stats, cli_stats_help, cli_show_stats, cli_reset_complete);
+#ifdef CLI_LATENCY
+CLI_COMMAND_COMPLETE(latency, cli_latency_help, cli_show_latency, cli_reset_complete);
+#endif
+#if CLI_CMD_PROFILE
+CLI_COMMAND_COMPLETE(time, cli_time_help, cli_time, cli_time_complete);
+CLI_COMMAND_COMPLETE(cmdstats, cli_cmdstats_help, cli_cmdstats, cli_reset_complete);
+#endif
+#if CLI_WATCH
+CLI_COMMAND_COMPLETE(watch, cli_watch_help, cli_watch, cli_watch_complete);
+#endif
+
+/*
+ * Bounds of the CLI_COMMAND section, defined by the linker. They are weak so that a
+ * program without any CLI_COMMAND still links (with an empty section).
+ */
+extern const COMMAND_S	__start_cli_commands[] __attribute__((weak));
+extern const COMMAND_S	__stop_cli_commands[] __attribute__((weak));
+
+#ifdef CLI_COMMANDS_HASH
+/* generated by tools/cli_commands_hash.py */
+extern const COMMAND_S *const	cli_commands_table[];	/* the CLI_COMMAND commands sorted by name, NULL for the ones not built */
+extern const char *const		cli_commands_names[];	/* their names, in the same order */
+extern const size_t				cli_commands_table_nb;
+extern const uint32_t			cli_commands_hash_seed;
+extern const uint32_t			cli_commands_hash_mask;
+extern const uint16_t			cli_commands_hash[];	/* index in cli_commands_table + 1, 0 if empty */
+#endif
+
 /*******************************************************************************
  *
  * 	These functions need to be redefined over the [_weak] versions defined by
@@ -122,42 +265,68 @@ int _write(int file, char *data, int len){
 		return -1;
 	}
 
-	if(cli_password_ok == false){
+	/* the interrupts and the other tasks print to the console, the commands to the shell that runs them */
+	bool in_irq = (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) != 0;
+	bool in_shell = !in_irq && CLI_OS_IN_TASK();
+	cli_ctx_s *ctx = in_shell ? cli_ctx_current : &cli_console;
+
+	if(ctx->password_ok == false){
 		return len;
 	}
 
-	HAL_StatusTypeDef status = HAL_OK;
-
-	if (!(SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) ) {
-		cli_tx_isr_flag = true;
-		/* Disable interrupts to prevent UART from throwing an RX interrupt while the peripheral is locked as
-		 * this would prevent the RX interrupt from restarting HAL_UART_Receive_IT  */
-		HAL_NVIC_DisableIRQ(USART1_IRQn);
+#if CLI_WATCH
+	if(cli_capture.buff != NULL && in_shell){
+		/* output of the command run by watch, it is displayed by watch */
+		size_t n = ((size_t)len < cli_capture.size - cli_capture.len) ? (size_t)len : cli_capture.size - cli_capture.len;
+		memcpy(&cli_capture.buff[cli_capture.len], data, n);
+		cli_capture.len += n;
+		return len;
+	}
+#endif
 
-		/* Transmits with interrupts. This must be done this way so that we can re-activate USART interrupts
-		 * before the transfer terminates so that we can continue reading from the terminal*/
-		status = HAL_UART_Transmit_IT(huart_shell, (uint8_t *)data, len);
+	/* Waiting for room is only possible outside of interrupts, as the room is made by the transmission interrupt */
+	bool can_wait = (CLI_TX_FULL_POLICY == CLI_TX_BLOCK) && !in_irq;
+	size_t written = 0;
 
-		HAL_NVIC_EnableIRQ(USART1_IRQn);
+	while(written < (size_t)len){
+		/* _write can be called from the main loop and from interrupts: pushing is done with interrupts masked */
+		CLI_ENTER_CRITICAL();
+		if(CLI_TX_FULL_POLICY == CLI_TX_DROP && (size_t)len > shell_queue_room(&ctx->tx_buff)){
+			CLI_EXIT_CRITICAL();
+			break;
+		}
+		size_t pushed = shell_queue_in_bulk(&ctx->tx_buff, (const uint8_t *)&data[written], len - written);
+		written += pushed;
+		ctx->stats.tx_bytes += pushed;
+		if(shell_queue_count(&ctx->tx_buff) > ctx->stats.tx_high_water){
+			ctx->stats.tx_high_water = shell_queue_count(&ctx->tx_buff);
+		}
+		cli_tx_start(ctx);
+		CLI_EXIT_CRITICAL();
 
-		/* Wait for the transfer to terminate*/
-		while(cli_tx_isr_flag == true){
-			/* flag will be set to false in HAL_UART_TxCpltCallback*/
+		if(!can_wait){
+			break;
+		}
+		if(written < (size_t)len){
+			/* Wait for the end of the transmission to make some room */
+			uint32_t start = HAL_GetTick();
+			while(shell_queue_room(&ctx->tx_buff) == 0){
+				CLI_ENTER_CRITICAL();
+				cli_tx_start(ctx);
+				CLI_EXIT_CRITICAL();
+			}
+			ctx->stats.tx_blocked_ms += HAL_GetTick() - start;
 		}
-	}else{
-		/* We are called from an interrupt, using Transmit_IT would not work */
-		HAL_NVIC_DisableIRQ(USART1_IRQn);
-		status = HAL_UART_Transmit(huart_shell, (uint8_t *)data, len, 1000);
-		HAL_NVIC_EnableIRQ(USART1_IRQn);
 	}
 
-
-
-	if(status == HAL_OK){
-		return len;
-	}else{
-		return 0;
+	if(written < (size_t)len){
+		CLI_ENTER_CRITICAL();
+		ctx->stats.tx_dropped += len - written;
+		CLI_EXIT_CRITICAL();
 	}
+
+	/* Whatever was dropped is reported as written: stdio would retry or flag stdout in error otherwise */
+	return len;
 }
 
 __attribute__((weak)) int _isatty(int file){
@@ -179,111 +348,234 @@ __attribute__((weak)) int _isatty(int file){
  ******************************************************************************/
 
 /**
-  * @brief          add a command to the history
+  * @brief          add a command to the history, evicting the oldest ones if needed
+  * @param  history:history of the shell context
   * @param  buff:   command
   * @retval         null
   */
-static void cli_history_add(char* buff)
+static void cli_history_add(HISTORY_S *history, char* buff)
 {
     uint16_t len;
-    uint8_t index = history.latest;
+    uint16_t need;
 
     if (NULL == buff) return;
 
     len = strlen((const char *)buff);
-    if (len >= MAX_LINE_LEN) return;  /* command too long */
-
-    /* find the latest one */
-    if (0 != index) {
-        index--;
-    } else {
-        index = HISTORY_MAX - 1;
-    }
-
-    if (0 != memcmp(history.cmd[index], buff, len)) {
-        /* if the new one is different with the latest one, the save */
-        memset((void *)history.cmd[history.latest], 0x00, MAX_LINE_LEN);
-        memcpy((void *)history.cmd[history.latest], (const void *)buff, len);
-        if (history.count < HISTORY_MAX) {
-            history.count++;
-        }
+    need = len + 2;
+    if (len >= MAX_LINE_LEN || need > history->size) return;  /* command too long */
+
+    /* if the new one is different with the latest one, then save */
+    if (0 == history->end || history->buff[history->end - 1] != len
+    		|| 0 != memcmp(&history->buff[history->end - 1 - len], buff, len)) {
+
+    	if (history->end + need > history->size) {
+    		/* drop as many of the oldest entries as needed, in a single move */
+    		uint16_t evict = 0;
+    		while (history->end - evict + need > history->size) {
+    			evict += history->buff[evict] + 2;
+    		}
+    		memmove(history->buff, &history->buff[evict], history->end - evict);
+    		history->end -= evict;
+    	}
 
-        history.latest++;
-        if (history.latest >= HISTORY_MAX) {
-            history.latest = 0;
-        }
+    	history->buff[history->end] = len;
+    	memcpy(&history->buff[history->end + 1], buff, len);
+    	history->buff[history->end + 1 + len] = len;
+    	history->end += need;
     }
 
-    history.show = 0;
+    history->show = history->end;
 }
 
 
 /**
   * @brief              returns a command from the history
+  * @param  history:    history of the shell context
   * @param  mode:       TRUE for look up, FALSE for look down
-  * @param  p_history:  target history command
+  * @param  p_history:  target history command, not null terminated
+  * @param  len:        length of the command
   * @retval             TRUE for no history found, FALSE for success
   */
-static uint8_t cli_history_show(uint8_t mode, char** p_history)
+static uint8_t cli_history_show(HISTORY_S *history, uint8_t mode, char** p_history, uint8_t *len)
 {
-    uint8_t err = true;
-    uint8_t num;
-    uint8_t index;
-
-    if (0 == history.count) return err;
+    if (0 == history->end) return true;
 
     if (true == mode) {
-        /* look up */
-        if (history.show < history.count) {
-            history.show++;
+        /* look up, stop at the oldest one */
+        if (history->show > 0) {
+            history->show -= history->buff[history->show - 1] + 2;
         }
     } else {
-        /* look down */
-        if (1 < history.show) {
-            history.show--;
+        /* look down, stop at the latest one */
+        if (history->show == history->end) {
+        	return true;
+        }
+        uint16_t next = history->show + history->buff[history->show] + 2;
+        if (next < history->end) {
+            history->show = next;
         }
     }
 
-    num = history.show;
-    index = history.latest;
-    while (num) {
-        if (0 != index) {
-            index--;
-        } else {
-            index = HISTORY_MAX - 1;
+    *len = history->buff[history->show];
+    *p_history = (char *)&history->buff[history->show + 1];
+
+    return false;
+}
+
+/**
+  * @brief              looks for the newest history entry containing a pattern
+  * @param  history:    history of the shell context
+  * @param  pattern:    pattern to look for
+  * @param  len:        length of the pattern
+  * @param  from:       only the entries ending at or before from are searched
+  * @param  at:         set to the position of the pattern in the entry found
+  * @retval             start of the entry found, HISTORY_NONE if the pattern is not found
+  */
+static uint16_t cli_history_search(const HISTORY_S *history, const char *pattern, uint8_t len, uint16_t from, uint8_t *at)
+{
+    while (from > 0) {
+        uint8_t cmd_len = history->buff[from - 1];
+        uint16_t start = from - cmd_len - 2;
+        const uint8_t *cmd = &history->buff[start + 1];
+
+        /* the length in front of each entry lets the ones that are too short be skipped */
+        for (uint8_t i = 0; i + len <= cmd_len; i++) {
+            if ((len == 0 || cmd[i] == (uint8_t)pattern[0]) && 0 == memcmp(&cmd[i], pattern, len)) {
+                *at = i;
+                return start;
+            }
         }
-        num--;
+        from = start;
     }
 
-    err = false;
-    *p_history = history.cmd[index];
+    return HISTORY_NONE;
+}
+
+/**
+  * @brief              updates the reverse search match, keeping the previous one if the pattern is not found
+  * @param  ctx:        shell context
+  * @param  from:       only the history entries ending at or before from are searched
+  * @retval             null
+  */
+static void cli_search_run(cli_ctx_s *ctx, uint16_t from)
+{
+	uint8_t at = 0;
+	uint16_t match = cli_history_search(&ctx->history, ctx->search.pattern, ctx->search.len, from, &at);
+
+	ctx->search.failing = (match == HISTORY_NONE);
+	if (!ctx->search.failing) {
+		ctx->search.match = match;
+		ctx->search.at = at;
+	}
+}
+
+/**
+  * @brief              handles a key while the reverse search is active
+  * @param  ctx:        shell context, its line receives the match when the search is accepted
+  * @param  key:        key received
+  * @retval             TRUE if the key was used by the search, FALSE if it must also be handled by the line editor
+  */
+static uint8_t cli_search_key(cli_ctx_s *ctx, const vt100_key_s *key)
+{
+	if (key->key == VT100_KEY_CTRL && key->ch == 'r') {
+		/* next older match */
+		if (ctx->search.match != HISTORY_NONE) {
+			cli_search_run(ctx, ctx->search.match);
+		}
+		return true;
+	} else if (key->key == VT100_KEY_CTRL && key->ch == 'g') {
+		/* abort, the line is left as it was */
+		ctx->search.active = false;
+		return true;
+	} else if (key->key == VT100_KEY_CHAR && !(key->mod & VT100_MOD_ALT)) {
+		/* narrow the search, the current match is checked first */
+		if (ctx->search.len < CLI_SEARCH_MAX) {
+			ctx->search.pattern[ctx->search.len++] = key->ch;
+			cli_search_run(ctx, (ctx->search.match == HISTORY_NONE) ? ctx->history.end
+							: ctx->search.match + ctx->history.buff[ctx->search.match] + 2);
+		}
+		return true;
+	} else if (key->key == VT100_KEY_BACKSPACE) {
+		if (ctx->search.len > 0) {
+			ctx->search.len--;
+		}
+		ctx->search.match = HISTORY_NONE;
+		cli_search_run(ctx, ctx->history.end);
+		return true;
+	}
+
+	/* any other key accepts the match and is then handled by the line editor */
+	ctx->search.active = false;
+	if (ctx->search.match != HISTORY_NONE) {
+		ctx->line.len = ctx->history.buff[ctx->search.match];
+		memcpy(ctx->line.buff, &ctx->history.buff[ctx->search.match + 1], ctx->line.len);
+		ctx->line.cursor = ctx->search.at;
+		ctx->history.show = ctx->search.match;
+	}
+	return false;
+}
+
+/**
+  * @brief              builds the reverse search view displayed in place of the line
+  * @param  ctx:        shell context
+  * @param  view:       output, of at least CLI_SHOWN_LEN characters
+  * @param  cursor:     set to the column of the cursor
+  * @retval             length of the view
+  */
+static uint8_t cli_search_render(const cli_ctx_s *ctx, uint8_t *view, uint8_t *cursor)
+{
+	const char *prompt = ctx->search.failing ? CLI_SEARCH_FAILING : CLI_SEARCH_PROMPT;
+	uint8_t n = strlen(prompt);
+
+	memcpy(view, prompt, n);
+	memcpy(&view[n], ctx->search.pattern, ctx->search.len);
+	n += ctx->search.len;
+	memcpy(&view[n], CLI_SEARCH_SEPARATOR, sizeof(CLI_SEARCH_SEPARATOR) - 1);
+	n += sizeof(CLI_SEARCH_SEPARATOR) - 1;
+
+	*cursor = n;
+	if (ctx->search.match != HISTORY_NONE) {
+		uint8_t len = ctx->history.buff[ctx->search.match];
+		memcpy(&view[n], &ctx->history.buff[ctx->search.match + 1], len);
+		*cursor = n + ctx->search.at;
+		n += len;
+	}
 
-    return err;
+	return n;
 }
 
 void cli_init(UART_HandleTypeDef *handle_uart)
 {
-	huart_shell = handle_uart;
-	shell_queue_init(&cli_rx_buff);
-    memset((uint8_t *)&history, 0, sizeof(history));
+#if CLI_STDOUT_BUFFERING != _IONBF
+    setvbuf(stdout, cli_stdout_buff, CLI_STDOUT_BUFFERING, sizeof(cli_stdout_buff));
+#else
+    setvbuf(stdout, NULL, _IONBF, 0);
+#endif
 
-    HAL_UART_MspInit(huart_shell);
-    HAL_UART_Receive_IT(huart_shell, &cBuffer, 1);
+#ifdef CLI_LOG_DEFERRED
+    SHELL_QUEUE_INIT(&cli_log_ring, cli_log_pool);
+#endif
 
-    for(size_t j = 0; j < MAX_COMMAND_NB; j++){
-    	CLI_commands[j].pCmd = "";
-    	CLI_commands[j].pFun = NULL;
-    }
+    cli_commands_nb = 0;
 
-#ifndef CLI_PASSWORD
-    cli_password_ok = true;
-    greet();
+#ifdef CLI_TIMESTAMP_DWT
+    /* starts the cycle counter, it is stopped out of reset when no debugger is attached */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 #endif
 
-    CLI_ADD_CMD("help", cli_help_help, cli_help);
-    CLI_ADD_CMD("cls", cli_clear_help, cli_clear);
-    CLI_ADD_CMD("reset", cli_reset_help, cli_reset);
-    CLI_ADD_CMD("log", cli_log_help, cli_log);
+    for(size_t i = 0; i < CLI_LAST_LOG_CATEGORY; i++){
+    	cli_log_rates[i] = (LOG_RATE_S){ .rate = CLI_LOG_RATE_DEFAULT, .tokens = CLI_LOG_RATE_DEFAULT, .last = HAL_GetTick() };
+    }
+#ifdef CLI_LOG_RATES
+#define R(name, n)	cli_log_rates[CLI_LOG_##name].rate = cli_log_rates[CLI_LOG_##name].tokens = (n);
+    CLI_LOG_RATES
+#undef R
+#endif
+
+    cli_console.huart = handle_uart;
+    cli_console.next = NULL;
+    cli_ctx_start(&cli_console);
 
     if(CLI_LAST_LOG_CATEGORY > 32){
     	ERR("Too many log categories defined. The max number of log categories that can be user defined is 31.\n");
@@ -293,221 +585,1461 @@ void cli_init(UART_HandleTypeDef *handle_uart)
 
 }
 
+void cli_ctx_add_uart(cli_ctx_s *ctx, UART_HandleTypeDef *huart)
+{
+	ctx->huart = huart;
+	ctx->transmit = NULL;
+	cli_ctx_start(ctx);
+}
+
+void cli_ctx_add(cli_ctx_s *ctx, cli_transmit_f transmit, void *user)
+{
+	ctx->huart = NULL;
+	ctx->transmit = transmit;
+	ctx->user = user;
+	cli_ctx_start(ctx);
+}
+
+/**
+  * @brief  		resets the state of a context, starts its reception and adds it to the
+  * 				contexts run by cli_run
+  * @param  ctx:	context, its transport already set
+  * @retval null
+  */
+static void cli_ctx_start(cli_ctx_s *ctx)
+{
+	ctx->rx_buff.Front = ctx->rx_buff.Rear = 0;
+	ctx->tx_buff.Front = ctx->tx_buff.Rear = 0;
+	ctx->tx_xfer = 0;
+	ctx->tx_refused = false;
+	ctx->rx_rearm = false;
+	ctx->rx_lapped = false;
+	ctx->rx_dma_pos = 0;
+	ctx->password_ok = false;
+	ctx->tab_pending = false;
+	ctx->history.end = ctx->history.show = 0;
+	memset(&ctx->line, 0, sizeof(ctx->line));
+	memset(&ctx->search, 0, sizeof(ctx->search));
+	memset(&ctx->job, 0, sizeof(ctx->job));
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+#ifdef CLI_LATENCY
+	ctx->echo_nb = 0;
+	memset(ctx->latency, 0, sizeof(ctx->latency));
+#endif
+	vt100_decoder_init(&ctx->decoder);
+
+	if(ctx->huart != NULL){
+		HAL_UART_MspInit(ctx->huart);
+		cli_rx_start(ctx);
+	}
+
+	if(ctx != &cli_console){
+		/* linked last, once it is ready: the interrupts may look for it from then on */
+		cli_ctx_s *last = &cli_console;
+		while(last->next != NULL){
+			last = last->next;
+		}
+		ctx->next = NULL;
+		last->next = ctx;
+	}
+
+#ifndef CLI_PASSWORD
+	cli_ctx_s *current = cli_ctx_current;
+
+	ctx->password_ok = true;
+	cli_ctx_select(ctx);
+	greet();
+	cli_ctx_select(current);
+#endif
+}
+
+/**
+  * @brief  		returns the context of a UART
+  * @param  huart:	UART
+  * @retval 		its context, NULL if the UART does not run a shell
+  */
+static cli_ctx_s *cli_ctx_find(UART_HandleTypeDef *huart)
+{
+	for(cli_ctx_s *ctx = &cli_console; ctx != NULL; ctx = ctx->next){
+		if(ctx->huart == huart){
+			return ctx;
+		}
+	}
+	return NULL;
+}
+
+/**
+  * @brief  		makes a context the one stdout writes to, after sending what was
+  * 				printed for the previous one
+  * @param  ctx:	context
+  * @retval null
+  */
+static void cli_ctx_select(cli_ctx_s *ctx)
+{
+	if(ctx != cli_ctx_current){
+		fflush(stdout);
+		cli_ctx_current = ctx;
+	}
+}
+
+void cli_ctx_receive(cli_ctx_s *ctx, const uint8_t *data, size_t len)
+{
+	bool was_empty = shell_queue_empty(&ctx->rx_buff);
+
+	ctx->stats.rx_bytes += len;
+	for(size_t i = 0; i < len; i++){
+		if(data[i] == KEY_CTRL_C){
+			/* seen here, a command that does not return does not read the queue */
+			ctx->job.cancel = true;
+		}
+	}
+#ifdef CLI_LATENCY
+	uint32_t now = CLI_TIMESTAMP_GET();
+	size_t room = shell_queue_room(&ctx->rx_buff);
+	for(size_t i = 0; i < len && i < room; i++){
+		ctx->rx_stamps[(ctx->rx_buff.Rear + i) & ctx->rx_buff.Mask] = now;
+	}
+#endif
+	size_t n = shell_queue_in_bulk(&ctx->rx_buff, data, len);
+
+	ctx->stats.rx_dropped += len - n;
+	if(shell_queue_count(&ctx->rx_buff) > ctx->stats.rx_high_water){
+		ctx->stats.rx_high_water = shell_queue_count(&ctx->rx_buff);
+	}
+	if(was_empty && n != 0){
+		/* the shell reads until the queue is empty, it only needs waking up for the first bytes */
+		CLI_OS_SIGNAL();
+	}
+}
+
+void cli_ctx_tx_done(cli_ctx_s *ctx)
+{
+	CLI_ENTER_CRITICAL();
+	shell_queue_release(&ctx->tx_buff, ctx->tx_xfer);
+	ctx->tx_xfer = 0;
+	cli_tx_start(ctx);
+	CLI_EXIT_CRITICAL();
+}
+
+#ifdef CLI_RX_DMA
+/*
+ * Callback function for UART IRQ on DMA half transfer, transfer complete or idle line.
+ * Size is the position reached by the DMA in the circular buffer, the data itself is
+ * left in place and drained by cli_rx_handle.
+ */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size){
+	cli_ctx_s *ctx = cli_ctx_find(huart);
+
+	if(ctx == NULL){
+		return;
+	}
+	/* the DMA writes the pool of rx_buff in place: only publish what it wrote since the last event */
+	shell_queue_s *rx = &ctx->rx_buff;
+	size_t len = (Size - ctx->rx_dma_pos) & rx->Mask;
+
+	ctx->rx_dma_pos = Size;
+	ctx->stats.rx_bytes += len;
+	if(ctx->rx_lapped || len > shell_queue_room(rx)){
+		/*
+		 * the DMA went past the bytes not read yet and overwrote them: nothing is published
+		 * (the queue would hold more than its size), cli_run drops what the queue holds and
+		 * starts again at the position of the DMA
+		 */
+		ctx->stats.rx_dropped += len;
+		ctx->rx_lapped = true;
+		CLI_OS_SIGNAL();
+		return;
+	}
+#ifdef CLI_LATENCY
+	/* the bytes are only known at the event, the time they waited in the buffer is not counted */
+	uint32_t now = CLI_TIMESTAMP_GET();
+	for(size_t i = 0; i < len && i <= rx->Mask; i++){
+		ctx->rx_stamps[(rx->Rear + i) & rx->Mask] = now;
+	}
+#endif
+	for(size_t i = 0; i < len && i <= rx->Mask; i++){
+		if(rx->PBase[(rx->Rear + i) & rx->Mask] == KEY_CTRL_C){
+			ctx->job.cancel = true;
+		}
+	}
+	shell_queue_commit(rx, len);
+	if(shell_queue_count(rx) > ctx->stats.rx_high_water){
+		ctx->stats.rx_high_water = shell_queue_count(rx);
+	}
+	if(len != 0){
+		CLI_OS_SIGNAL();
+	}
+}
+#else
 /*
  * Callback function for UART IRQ when it is done receiving a char
  */
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef * huart){
-	shell_queue_in(&cli_rx_buff, &cBuffer);
-	HAL_UART_Receive_IT(huart, &cBuffer, 1);
+	cli_ctx_s *ctx = cli_ctx_find(huart);
+
+	if(ctx == NULL){
+		return;
+	}
+	/* a byte at a time, the bulk path of cli_ctx_receive is not worth it */
+	bool was_empty = shell_queue_empty(&ctx->rx_buff);
+
+	ctx->stats.rx_bytes++;
+	if(ctx->cBuffer == KEY_CTRL_C){
+		ctx->job.cancel = true;
+	}
+#ifdef CLI_LATENCY
+	if(!shell_queue_full(&ctx->rx_buff)){
+		ctx->rx_stamps[ctx->rx_buff.Rear & ctx->rx_buff.Mask] = CLI_TIMESTAMP_GET();
+	}
+#endif
+	if(!shell_queue_in(&ctx->rx_buff, &ctx->cBuffer)){
+		ctx->stats.rx_dropped++;
+	}else if(shell_queue_count(&ctx->rx_buff) > ctx->stats.rx_high_water){
+		ctx->stats.rx_high_water = shell_queue_count(&ctx->rx_buff);
+	}
+	if(was_empty){
+		CLI_OS_SIGNAL();
+	}
+	HAL_UART_Receive_IT(huart, &ctx->cBuffer, 1);
+}
+#endif
+
+/*
+ * Callback function for UART IRQ on an error. The HAL stops the reception on an overrun
+ * (and on a DMA error), which would leave the shell deaf: it is started again.
+ */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart){
+	cli_ctx_s *ctx = cli_ctx_find(huart);
+
+	if(ctx == NULL){
+		return;
+	}
+	uint32_t error = huart->ErrorCode;
+
+	ctx->stats.uart_overrun += (error & HAL_UART_ERROR_ORE) != 0;
+	ctx->stats.uart_framing += (error & HAL_UART_ERROR_FE) != 0;
+	ctx->stats.uart_noise += (error & HAL_UART_ERROR_NE) != 0;
+	ctx->stats.uart_parity += (error & HAL_UART_ERROR_PE) != 0;
+	ctx->stats.uart_dma += (error & HAL_UART_ERROR_DMA) != 0;
+#ifdef CLI_RX_DMA
+	/* the DMA restarts at the start of the buffer, once cli_run has read what it holds */
+	ctx->rx_rearm = true;
+	CLI_OS_SIGNAL();
+#else
+	cli_rx_start(ctx);
+#endif
+}
+
+/**
+  * @brief  		arms the reception of the UART of a context
+  * @param  ctx:	context
+  * @retval null
+  */
+static void cli_rx_start(cli_ctx_s *ctx)
+{
+	if(ctx->huart == NULL){
+		/* the transport calls cli_ctx_receive by itself */
+		return;
+	}
+#ifdef CLI_RX_DMA
+	HAL_UARTEx_ReceiveToIdle_DMA(ctx->huart, ctx->rx_buff.PBase, ctx->rx_buff.Mask + 1);
+#else
+	HAL_UART_Receive_IT(ctx->huart, &ctx->cBuffer, 1);
+#endif
+}
+
+/*
+ * Callback function for UART IRQ when it is done transmitting data
+ */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef * huart){
+	cli_ctx_s *ctx = cli_ctx_find(huart);
+
+	if(ctx != NULL){
+		cli_ctx_tx_done(ctx);
+	}
+}
+
+/**
+  * @brief  		starts transmitting the next contiguous span of the ring of a context
+  * 				if its transport is idle. Must be called with interrupts masked.
+  * @param  ctx:	context
+  * @retval null
+  */
+static void cli_tx_start(cli_ctx_s *ctx)
+{
+	uint8_t *span;
+	size_t len;
+	bool busy;
+
+	if(ctx->tx_xfer != 0){
+		return;
+	}
+
+	len = shell_queue_peek_span(&ctx->tx_buff, &span);
+	if(len == 0){
+		return;
+	}
+	/* set before starting: the transport may be done before it returns */
+	ctx->tx_xfer = len;
+	if(ctx->huart == NULL){
+		busy = ctx->transmit(ctx, span, len) != 0;
+#ifdef CLI_TX_DMA
+	}else{
+		busy = HAL_UART_Transmit_DMA(ctx->huart, span, len) != HAL_OK;
+#else
+	}else{
+		busy = HAL_UART_Transmit_IT(ctx->huart, span, len) != HAL_OK;
+#endif
+	}
+	if(busy){
+		/* transport busy, the transfer will be retried by the next cli_run (or the
+		 * loop waiting for room): it is counted once until it is accepted */
+		ctx->tx_xfer = 0;
+		if(!ctx->tx_refused){
+			ctx->tx_refused = true;
+			ctx->stats.tx_errors++;
+		}
+	}else{
+		ctx->tx_refused = false;
+	}
+}
+
+/**
+  * @brief  		copies the received characters of a context that have not been handled yet
+  * @param  ctx:	context
+  * @param  data:	destination buffer
+  * @param  max:	maximum number of characters to copy
+  * @retval 		number of characters copied
+  */
+static size_t cli_rx_read(cli_ctx_s *ctx, uint8_t *data, size_t max)
+{
+#ifdef CLI_LATENCY
+	size_t front = ctx->rx_buff.Front;
+	size_t len = shell_queue_out_bulk(&ctx->rx_buff, data, max);
+
+	/* the bytes past a queue full of them in the same cli_run are not measured */
+	for(size_t i = 0; i < len && ctx->echo_nb <= ctx->rx_buff.Mask; i++){
+		ctx->echo_stamps[ctx->echo_nb++] = ctx->rx_stamps[(front + i) & ctx->rx_buff.Mask];
+	}
+	return len;
+#else
+	return shell_queue_out_bulk(&ctx->rx_buff, data, max);
+#endif
+}
+
+/**
+  * @brief  		executes a complete line entered in the terminal of a context
+  * @param  ctx:	context
+  * @param  line:	line, without the line termination
+  * @retval null
+  */
+static void cli_exec_line(cli_ctx_s *ctx, char *line)
+{
+    if(!ctx->password_ok){
+#ifdef CLI_PASSWORD
+    	if(strcmp(line, XSTRING(CLI_PASSWORD)) == 0){
+    		ctx->password_ok = true;
+    		greet();
+    	}
+#else
+    	ctx->password_ok = true;
+    	greet();
+#endif
+    	return;
+    }
+
+    if(line[0] == '\0') {
+        /* KEY_ENTER -->ENTER key from terminal */
+    	PRINT_CLI_NAME();
+    	return;
+    }
+
+	NL1();
+	cli_history_add(&ctx->history, line);
+	char *command = strtok(line, " \t");
+
+	/* looking for a match */
+	const COMMAND_S *cmd = (command != NULL) ? cli_command_find(command) : NULL;
+	if(cmd != NULL) {
+		//Split arguments string to argc/argv
+		uint8_t argc = 1;
+		char 	*argv[MAX_ARGC];
+		argv[0] = command;
+
+		char *token = strtok(NULL, " \t");
+		while(token != NULL){
+			if(argc >= MAX_ARGC){
+				printf(CLI_FONT_RED "Maximum number of arguments is %d. Ignoring the rest of the arguments."CLI_FONT_DEFAULT, MAX_ARGC-1);NL1();
+				break;
+			}
+			argv[argc] = token;
+			argc++;
+			token = strtok(NULL, " \t");
+		}
+
+		if(cmd->pFun != NULL) {
+			/* call the func. */
+			TERMINAL_HIDE_CURSOR();
+			ctx->job.lc = 0;
+			ctx->job.cancel = false;
+			ctx->job.key = false;
+			uint8_t result = cli_command_exec(cmd, argc, argv);
+
+			if(CLI_NOT_DONE(result)){
+				/* the result and the prompt are printed once it is done */
+				cli_job_start(ctx, line, argc, argv);
+				return;
+			}
+			cli_exec_result(command, result);
+		} else {
+			/* func. is void */
+			printf(CLI_FONT_RED "Command %s exists but no function is associated to it.", command);NL1();
+		}
+	} else {
+		/* no matching command */
+		printf("\r\nCommand \"%s\" unknown, try: help", line);NL1();
+	}
+
+	PRINT_CLI_NAME();
+}
+
+/**
+  * @brief  			prints the result of a command
+  * @param  command:	name of the command
+  * @param  result:		returned by the command
+  * @retval null
+  */
+static void cli_exec_result(const char *command, uint8_t result)
+{
+	if(result == EXIT_SUCCESS){
+		printf(CLI_FONT_GREEN "(%s returned %d)" CLI_FONT_DEFAULT, command, result);NL1();
+	}else{
+		printf(CLI_FONT_RED "(%s returned %d)" CLI_FONT_DEFAULT, command, result);NL1();
+	}
+	TERMINAL_SHOW_CURSOR();
+}
+
+/**
+  * @brief  		keeps a command that returned CLI_RUNNING to call it again from cli_run
+  * @param  ctx:	context running the command
+  * @param  line:	tokenized line (MAX_LINE_LEN bytes), argv points in it
+  * @param  argc:	number of arguments
+  * @param  argv:	arguments
+  * @retval null
+  */
+static void cli_job_start(cli_ctx_s *ctx, const char *line, int argc, char *argv[])
+{
+	memcpy(ctx->job.line, line, sizeof(ctx->job.line));
+	for(int i = 0; i < argc; i++){
+		ctx->job.argv[i] = ctx->job.line + (argv[i] - line);
+	}
+	ctx->job.argc = argc;
+	ctx->job.running = true;
+}
+
+/**
+  * @brief  calls the running command again, until it is done or its time budget is
+  * 		spent, and cancels it on Ctrl-C
+  * @param  ctx:	context running the command
+  * @retval null
+  */
+static void cli_job_handle(cli_ctx_s *ctx)
+{
+	/* looked up at each call, the command can add others and move the table */
+	const COMMAND_S *cmd = cli_command_find(ctx->job.argv[0]);
+	uint32_t budget = (uint32_t)((uint64_t)CLI_JOB_BUDGET_US * CLI_TIMESTAMP_FREQ / 1000000U);
+	uint32_t start = CLI_TIMESTAMP_GET();
+	uint8_t result = CLI_RUNNING;
+
+	if(cmd == NULL){
+		/* removed while it was running */
+		result = EXIT_FAILURE;
+	}else{
+		do {
+			result = cli_command_exec(cmd, ctx->job.argc, ctx->job.argv);
+		} while(result == CLI_RUNNING && !ctx->job.cancel && CLI_TIMESTAMP_GET() - start < budget);
+	}
+
+	if(ctx->job.cancel){
+		if(CLI_NOT_DONE(result)){
+			/* last call, to let it release what it holds */
+			cli_command_exec(cmd, ctx->job.argc, ctx->job.argv);
+		}
+		printf(CLI_FONT_RED "^C (%s cancelled)" CLI_FONT_DEFAULT, ctx->job.argv[0]);NL1();
+		TERMINAL_SHOW_CURSOR();
+	}else if(CLI_NOT_DONE(result)){
+		return;
+	}else{
+		cli_exec_result(ctx->job.argv[0], result);
+	}
+	ctx->job.running = false;
+	ctx->job.lc = 0;
+	PRINT_CLI_NAME();
+}
+
+/**
+  * @brief  		redraws the line being edited, sending only what changed since the last redraw
+  * @param  ctx:	context
+  * @retval null
+  */
+static void cli_line_refresh(cli_ctx_s *ctx)
+{
+	HANDLE_TYPE_S *line = &ctx->line;
+	char out[VT100_LINE_UPDATE_SIZE(CLI_SHOWN_LEN)];
+	uint8_t view[CLI_SHOWN_LEN];
+	const uint8_t *text = line->buff;
+	uint8_t len = line->len;
+	uint8_t cursor = line->cursor;
+	uint16_t n;
+
+	if(!ctx->password_ok){
+		/* nothing is displayed while the password is typed */
+		return;
+	}
+
+	if(ctx->search.active){
+		len = cli_search_render(ctx, view, &cursor);
+		text = view;
+	}
+
+	n = vt100_line_update(out, line->shown, line->shown_len, line->shown_cursor,
+							text, len, cursor);
+	if(n > 0){
+		fwrite(out, 1, n, stdout);
+	}
+
+	memcpy(line->shown, text, len);
+	line->shown_len = len;
+	line->shown_cursor = cursor;
+}
+
+/**
+  * @brief  		empties the line, to be called when a new prompt has been printed
+  * @param  line:	line being edited
+  * @retval null
+  */
+static void cli_line_clear(HANDLE_TYPE_S *line)
+{
+	line->len = line->cursor = 0;
+	line->shown_len = line->shown_cursor = 0;
+}
+
+/**
+  * @brief  		inserts a character at the cursor
+  * @param  line:	line being edited
+  * @param  c:		character to insert
+  * @retval null
+  */
+static void cli_line_insert(HANDLE_TYPE_S *line, char c)
+{
+	memmove(&line->buff[line->cursor + 1], &line->buff[line->cursor], line->len - line->cursor);
+	line->buff[line->cursor] = c;
+	line->cursor++;
+	line->len++;
+}
+
+/**
+  * @brief  		removes the characters [from, to) of the line and moves the cursor at from
+  * @param  line:	line being edited
+  * @retval null
+  */
+static void cli_line_delete(HANDLE_TYPE_S *line, uint8_t from, uint8_t to)
+{
+	memmove(&line->buff[from], &line->buff[to], line->len - to);
+	line->len -= to - from;
+	line->cursor = from;
+}
+
+/**
+  * @brief  		finds the start of the word left of the cursor
+  * @param  line:	line being edited
+  * @retval 		column of the start of the word
+  */
+static uint8_t cli_line_word_left(HANDLE_TYPE_S *line)
+{
+	uint8_t i = line->cursor;
+
+	while(i > 0 && line->buff[i - 1] == ' '){
+		i--;
+	}
+	while(i > 0 && line->buff[i - 1] != ' '){
+		i--;
+	}
+	return i;
+}
+
+/**
+  * @brief  		finds the end of the word right of the cursor
+  * @param  line:	line being edited
+  * @retval 		column following the end of the word
+  */
+static uint8_t cli_line_word_right(HANDLE_TYPE_S *line)
+{
+	uint8_t i = line->cursor;
+
+	while(i < line->len && line->buff[i] == ' '){
+		i++;
+	}
+	while(i < line->len && line->buff[i] != ' '){
+		i++;
+	}
+	return i;
+}
+
+/**
+  * @brief  			finds the first command, in name order, that is not before name
+  * @param  declared:	among the CLI_COMMAND commands (cli_commands_names, only generated
+  * 					with CLI_COMMANDS_HASH), else among the ones added at runtime (CLI_commands)
+  * @param  name:		name to look for
+  * @param  len:		characters compared, SIZE_MAX for whole names and strlen(name) for a prefix
+  * @retval 			position in the table, its number of commands if all of them are before name
+  */
+static size_t cli_command_lower_bound(bool declared, const char *name, size_t len)
+{
+	size_t lo = 0;
+	size_t hi = declared ? cli_static_commands_nb() : cli_commands_nb;
+
+	while(lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+#ifdef CLI_COMMANDS_HASH
+		const char *cmd = declared ? cli_commands_names[mid] : CLI_commands[mid].pCmd;
+#else
+		const char *cmd = CLI_commands[mid].pCmd;
+#endif
+		int cmp = (len == SIZE_MAX) ? strcmp(cmd, name) : strncmp(cmd, name, len);
+		if(cmp < 0){
+			lo = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+#ifdef CLI_COMMANDS_HASH
+/**
+  * @brief  		hash of a command name (FNV-1a), must match tools/cli_commands_hash.py
+  */
+static uint32_t cli_command_hash(const char *name, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ seed;
+
+	while(*name != '\0'){
+		h ^= (uint8_t)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+#endif
+
+/**
+  * @brief  		number of commands declared with CLI_COMMAND, the ones not built
+  * 				included if the index is generated
+  */
+static size_t cli_static_commands_nb(void)
+{
+#ifdef CLI_COMMANDS_HASH
+	return cli_commands_table_nb;
+#else
+	return (size_t)(__stop_cli_commands - __start_cli_commands);
+#endif
+}
+
+/**
+  * @brief  		i-th command declared with CLI_COMMAND, in name order if the index is
+  * 				generated and in link order otherwise
+  * @retval 		the command, NULL if it is not built in this configuration
+  */
+static const COMMAND_S *cli_static_command(size_t i)
+{
+#ifdef CLI_COMMANDS_HASH
+	return cli_commands_table[i];
+#else
+	return &__start_cli_commands[i];
+#endif
+}
+
+/**
+  * @brief  		looks for a command declared with CLI_COMMAND, through the perfect hash
+  * 				table if the index is generated and by scanning the section otherwise
+  * @param  name:	name of the command
+  * @retval 		the command, NULL if it does not exist
+  */
+static const COMMAND_S *cli_static_command_find(const char *name)
+{
+#ifdef CLI_COMMANDS_HASH
+	uint16_t i = cli_commands_hash[cli_command_hash(name, cli_commands_hash_seed) & cli_commands_hash_mask];
+
+	if(i != 0 && cli_commands_table[i - 1] != NULL && strcmp(cli_commands_names[i - 1], name) == 0){
+		return cli_commands_table[i - 1];
+	}
+#else
+	for(const COMMAND_S *cmd = __start_cli_commands; cmd < __stop_cli_commands; cmd++){
+		if(strcmp(cmd->pCmd, name) == 0){
+			return cmd;
+		}
+	}
+#endif
+	return NULL;
+}
+
+/**
+  * @brief  		looks for a command, first among the CLI_COMMAND ones then by binary
+  * 				search among the ones added at runtime
+  * @param  name:	name of the command
+  * @retval 		the command, NULL if it does not exist
+  */
+static const COMMAND_S *cli_command_find(const char *name)
+{
+	const COMMAND_S *cmd = cli_static_command_find(name);
+	if(cmd != NULL){
+		return cmd;
+	}
+
+	size_t i = cli_command_lower_bound(false, name, SIZE_MAX);
+	if(i < cli_commands_nb && strcmp(CLI_commands[i].pCmd, name) == 0){
+		return &CLI_commands[i];
+	}
+	return NULL;
+}
+
+/**
+  * @brief  		calls a command and adds the call to its statistics
+  * @param  cmd:	command, with a function
+  * @param  argc:	number of arguments, the command included
+  * @param  argv:	arguments
+  * @retval 		what the command returned
+  */
+static uint8_t cli_command_exec(const COMMAND_S *cmd, int argc, char *argv[])
+{
+#if CLI_CMD_PROFILE
+	const char *name = cmd->pCmd;
+	size_t nb = cli_commands_nb;
+	uint32_t start = CLI_TIMESTAMP_GET();
+	uint8_t result = cmd->pFun(argc, argv);
+	uint32_t time = CLI_TIMESTAMP_GET() - start;
+
+	if(cli_commands_nb != nb){
+		/* the command added commands: the table, with this entry, may have moved */
+		cmd = cli_command_find(name);
+	}
+	CMD_STATS_S *stats = cmd->pStats;
+	if(stats != NULL){
+		if(stats->calls == 0 || time < stats->min){
+			stats->min = time;
+		}
+		if(time > stats->max){
+			stats->max = time;
+		}
+		stats->calls++;
+		stats->total += time;
+		stats->result = result;
+	}
+	return result;
+#else
+	return cmd->pFun(argc, argv);
+#endif
+}
+
+/**
+  * @brief  		returns a completion candidate for the last word of argv
+  * @param  argc:	number of words, the last one being completed
+  * @param  argv:	words of the line up to the cursor
+  * @param  index:	index of the candidate
+  * @retval 		candidate, NULL when there are no more of them
+  */
+static const char *cli_complete_candidate(int argc, char *argv[], size_t index)
+{
+	if(argc == 1){
+		size_t len = strlen(argv[0]);
+#ifdef CLI_COMMANDS_HASH
+		/* the commands starting with the word are contiguous in the sorted index */
+		for(size_t i = cli_command_lower_bound(true, argv[0], len);
+				i < cli_commands_table_nb && 0 == strncmp(cli_commands_names[i], argv[0], len); i++){
+			if(cli_commands_table[i] != NULL && index-- == 0){
+				return cli_commands_names[i];
+			}
+		}
+#else
+		for(const COMMAND_S *cmd = __start_cli_commands; cmd < __stop_cli_commands; cmd++){
+			if(0 == strncmp(cmd->pCmd, argv[0], len) && index-- == 0){
+				return cmd->pCmd;
+			}
+		}
+#endif
+		/* and in the table of the runtime commands */
+		size_t i = cli_command_lower_bound(false, argv[0], len) + index;
+		if(i < cli_commands_nb && 0 == strncmp(CLI_commands[i].pCmd, argv[0], len)){
+			return CLI_commands[i].pCmd;
+		}
+		return NULL;
+	}
+
+	const COMMAND_S *cmd = cli_command_find(argv[0]);
+	if(cmd != NULL && cmd->pComplete != NULL){
+		return cmd->pComplete(argc, argv, index);
+	}
+	return NULL;
+}
+
+/**
+  * @brief  		completes the word at the cursor (Tab)
+  * @param  line:	line being edited
+  * @param  list:	print the candidates if there are several of them and none can be completed
+  * @retval 		number of candidates
+  */
+static size_t cli_line_complete(HANDLE_TYPE_S *line, bool list)
+{
+	char words[MAX_LINE_LEN];
+	char *argv[MAX_ARGC];
+	int argc = 0;
+	const char *first = NULL;
+	const char *candidate;
+	size_t prefix_len;
+	size_t common = 0;
+	size_t count = 0;
+	uint8_t added = false;
+
+	/* split the line up to the cursor, the last word being the one to complete */
+	memcpy(words, line->buff, line->cursor);
+	words[line->cursor] = '\0';
+	char *token = strtok(words, " \t");
+	while(token != NULL && argc < MAX_ARGC){
+		argv[argc++] = token;
+		token = strtok(NULL, " \t");
+	}
+	if(line->cursor == 0 || line->buff[line->cursor - 1] == ' ' || line->buff[line->cursor - 1] == '\t'){
+		/* starting a new word */
+		if(argc >= MAX_ARGC){
+			return 0;
+		}
+		argv[argc++] = &words[line->cursor];
+	}
+	prefix_len = strlen(argv[argc - 1]);
+
+	for(size_t i = 0; (candidate = cli_complete_candidate(argc, argv, i)) != NULL; i++){
+		if(0 != strncmp(candidate, argv[argc - 1], prefix_len)){
+			continue;
+		}
+		if(count == 0){
+			first = candidate;
+			common = strlen(candidate);
+		}else{
+			size_t j = prefix_len;
+			while(j < common && first[j] == candidate[j]){
+				j++;
+			}
+			common = j;
+		}
+		count++;
+	}
+
+	if(count == 0){
+		printf("\a");
+		return 0;
+	}
+
+	/* add the part common to all the candidates, and a space if there is only one */
+	for(size_t j = prefix_len; j < common && line->len < MAX_LINE_LEN - 1; j++){
+		cli_line_insert(line, first[j]);
+		added = true;
+	}
+	if(count == 1 && line->len < MAX_LINE_LEN - 1
+			&& (line->cursor == line->len || line->buff[line->cursor] != ' ')){
+		cli_line_insert(line, ' ');
+		added = true;
+	}
+
+	if(!added && list && count > 1){
+		NL1();
+		for(size_t i = 0; (candidate = cli_complete_candidate(argc, argv, i)) != NULL; i++){
+			if(0 == strncmp(candidate, argv[argc - 1], prefix_len)){
+				printf("%s  ", candidate);
+			}
+		}
+		PRINT_CLI_NAME();
+		/* the line has to be displayed again after the new prompt */
+		line->shown_len = line->shown_cursor = 0;
+	}
+
+	return count;
+}
+
+/**
+  * @brief  		handle commands from the terminal of a context
+  * @param  ctx:	context
+  * @retval null
+  */
+static void cli_rx_handle(cli_ctx_s *ctx)
+{
+    HANDLE_TYPE_S *line = &ctx->line;
+    uint8_t rx_span[MAX_LINE_LEN];
+    bool dirty = false;					/* the line changed since it was last redrawn */
+
+    /* decode the chars from the terminal, a key at a time, and redraw the line once per span */
+    for(;;) {
+#ifdef CLI_LATENCY
+    	size_t stamps = ctx->echo_nb;		/* the stamps of the span follow */
+#endif
+    	size_t rx_len = cli_rx_read(ctx, rx_span, sizeof(rx_span));
+    	size_t rx_pos = 0;
+
+    	if(rx_len == 0) {
+    		break;
+    	}
+    	for(; rx_pos < rx_len && !ctx->job.running; rx_pos++) {
+    		vt100_key_s key;
+    		char *p_hist_cmd = 0;
+    		uint8_t hist_len = 0;
+    		bool word = false;
+
+    		if(vt100_decode(&ctx->decoder, rx_span[rx_pos], &key) == VT100_KEY_NONE) {
+    			continue;
+    		}
+
+    		if(key.key != VT100_KEY_TAB) {
+    			ctx->tab_pending = false;
+    		}
+
+    		if(ctx->search.active && cli_search_key(ctx, &key)) {
+    			dirty = true;
+    			continue;
+    		}
+
+    		/* the keys that print more than the line need it to be up to date first */
+    		if(dirty && (key.key == VT100_KEY_TAB || key.key == VT100_KEY_ENTER
+    				|| (key.key == VT100_KEY_CHAR && line->len >= MAX_LINE_LEN - 1))) {
+    			cli_line_refresh(ctx);
+    			dirty = false;
+    		}
+
+    		switch(key.key) {
+    		case VT100_KEY_TAB:
+    			if(ctx->password_ok) {
+    				ctx->tab_pending = (cli_line_complete(line, ctx->tab_pending) > 1) && !ctx->tab_pending;
+    				cli_line_refresh(ctx);
+    			}
+    			continue;
+
+    		case VT100_KEY_CHAR:
+    			if(key.mod & VT100_MOD_ALT) {
+    				/* Alt-b / Alt-f: word left / right, Alt-d: delete the next word */
+    				if(key.ch == 'b') {
+    					line->cursor = cli_line_word_left(line);
+    				} else if(key.ch == 'f') {
+    					line->cursor = cli_line_word_right(line);
+    				} else if(key.ch == 'd') {
+    					cli_line_delete(line, line->cursor, cli_line_word_right(line));
+    				}
+    				break;
+    			}
+    			if(line->len >= MAX_LINE_LEN - 1) {
+    				/* full, so restart the count */
+    				ctx->stats.lines_truncated++;
+    				printf(CLI_FONT_RED "\r\nMax command length is %d.\r\n" CLI_FONT_DEFAULT, MAX_LINE_LEN-1);
+    				PRINT_CLI_NAME();
+    				cli_line_clear(line);
+    				continue;
+    			}
+    			cli_line_insert(line, key.ch);
+    			break;
+
+    		case VT100_KEY_BACKSPACE:
+    			if(line->cursor > 0) {
+    				cli_line_delete(line, line->cursor - 1, line->cursor);
+    			}
+    			break;
+
+    		case VT100_KEY_DELETE:
+    			if(line->cursor < line->len) {
+    				cli_line_delete(line, line->cursor, line->cursor + 1);
+    			}
+    			break;
+
+    		case VT100_KEY_LEFT:
+    		case VT100_KEY_RIGHT:
+    			word = (key.mod & (VT100_MOD_CTRL | VT100_MOD_ALT)) != 0;
+    			if(key.key == VT100_KEY_LEFT) {
+    				if(word) {
+    					line->cursor = cli_line_word_left(line);
+    				} else if(line->cursor > 0) {
+    					line->cursor--;
+    				}
+    			} else {
+    				if(word) {
+    					line->cursor = cli_line_word_right(line);
+    				} else if(line->cursor < line->len) {
+    					line->cursor++;
+    				}
+    			}
+    			break;
+
+    		case VT100_KEY_HOME:
+    			line->cursor = 0;
+    			break;
+
+    		case VT100_KEY_END:
+    			line->cursor = line->len;
+    			break;
+
+    		case VT100_KEY_CTRL:
+    			/* emacs style editing keys */
+    			switch(key.ch) {
+    			case 'a': line->cursor = 0; break;
+    			case 'e': line->cursor = line->len; break;
+    			case 'b': if(line->cursor > 0) { line->cursor--; } break;
+    			case 'f': if(line->cursor < line->len) { line->cursor++; } break;
+    			case 'd': if(line->cursor < line->len) { cli_line_delete(line, line->cursor, line->cursor + 1); } break;
+    			case 'k': cli_line_delete(line, line->cursor, line->len); break;
+    			case 'u': cli_line_delete(line, 0, line->cursor); break;
+    			case 'w': cli_line_delete(line, cli_line_word_left(line), line->cursor); break;
+    			case 'c':
+    				/* drop the line */
+    				line->cursor = line->len;
+    				cli_line_refresh(ctx);
+    				printf("^C");
+    				PRINT_CLI_NAME();
+    				cli_line_clear(line);
+    				continue;
+    			case 'r':
+    				/* start a reverse history search */
+    				if(ctx->password_ok) {
+    					memset(&ctx->search, 0, sizeof(ctx->search));
+    					ctx->search.active = true;
+    					ctx->search.match = HISTORY_NONE;
+    				}
+    				break;
+    			default: break;
+    			}
+    			break;
+
+    		case VT100_KEY_UP:
+    		case VT100_KEY_DOWN:
+    			if(!ctx->password_ok) {
+    				break;
+    			}
+    			line->len = line->cursor = 0;
+    			if(!cli_history_show(&ctx->history, key.key == VT100_KEY_UP, &p_hist_cmd, &hist_len)) {
+    				line->len = line->cursor = hist_len;
+    				memcpy(line->buff, p_hist_cmd, line->len);
+    			}
+    			break;
+
+    		case VT100_KEY_ENTER:
+    			/* handle the command */
+    			line->cursor = line->len;
+    			cli_line_refresh(ctx);
+    			line->buff[line->len] = '\0';
+    			cli_exec_line(ctx, (char *)line->buff);
+    			cli_line_clear(line);
+    			continue;
+
+    		default:
+    			break;
+    		}
+
+    		dirty = true;
+    	}
+
+    	if(rx_pos < rx_len) {
+#ifdef CLI_LATENCY
+    		/* dropped without echo, their latency is not counted */
+    		if(ctx->echo_nb > stamps + rx_pos) {
+    			ctx->echo_nb = stamps + rx_pos;
+    		}
+#endif
+    		/* no type-ahead while a command runs, started by this span or before, but any
+    		 * key stops a command waiting for one and Ctrl-C cancels it (the flag set by the
+    		 * interrupt is cleared when the command starts) */
+    		for(; rx_pos < rx_len; rx_pos++) {
+    			vt100_key_s key;
+    			uint8_t k = vt100_decode(&ctx->decoder, rx_span[rx_pos], &key);
+
+    			if(k != VT100_KEY_NONE) {
+    				ctx->job.key = true;
+    			}
+    			if(k == VT100_KEY_CTRL && key.ch == 'c') {
+    				ctx->job.cancel = true;
+    			}
+    		}
+    	}
+
+    	if(dirty) {
+    		cli_line_refresh(ctx);
+    		dirty = false;
+    	}
+    }
+}
+
+/**
+  * @brief  		tx handle, flushes stdout buffer and restarts the transmission of a context
+  * 				if it is stalled
+  * @param  ctx:	context
+  * @retval null
+  */
+static void cli_tx_handle(cli_ctx_s *ctx)
+{
+	/* only what stdout holds since its last flush (e.g. the echo of the line) is left */
+	if(__fpending(stdout) != 0){
+		fflush(stdout);
+	}
+
+    CLI_ENTER_CRITICAL();
+    cli_tx_start(ctx);
+    CLI_EXIT_CRITICAL();
+#ifdef CLI_LATENCY
+    cli_latency_handle(ctx);
+#endif
+}
+
+#ifdef CLI_LATENCY
+/**
+  * @brief  counts the latency of the bytes read by this cli_run, whose echo has just been
+  * 		handed to the transmitter
+  * @param  ctx:	context
+  * @retval null
+  */
+static void cli_latency_handle(cli_ctx_s *ctx)
+{
+	uint32_t now = CLI_TIMESTAMP_GET();
+
+	for(size_t i = 0; i < ctx->echo_nb; i++){
+		uint32_t time = now - ctx->echo_stamps[i];
+		ctx->latency[(time == 0) ? 0 : 31 - __builtin_clz(time)]++;
+	}
+	ctx->echo_nb = 0;
+}
+#endif
+
+#ifdef CLI_LOG_DEFERRED
+void cli_log_defer(uint8_t cat, const char *fmt, uint8_t nargs, const uintptr_t *args)
+{
+	uintptr_t record[3 + CLI_LOG_MAX_ARGS];
+	size_t len = (3 + nargs) * sizeof(uintptr_t);
+
+	record[0] = cat | (nargs << 8);
+	record[1] = (uintptr_t)fmt;
+#ifdef CLI_TIMESTAMP
+	record[2] = CLI_TIMESTAMP_GET();
+#else
+	record[2] = HAL_GetTick();
+#endif
+	memcpy(&record[3], args, nargs * sizeof(uintptr_t));
+
+	/* the interrupts that log too are the other producers: the record is written at once */
+	CLI_ENTER_CRITICAL();
+	if(shell_queue_room(&cli_log_ring) >= len){
+		shell_queue_in_bulk(&cli_log_ring, (uint8_t *)record, len);
+	}else{
+		cli_log_dropped++;
+	}
+	CLI_EXIT_CRITICAL();
+	CLI_OS_SIGNAL();
+}
+
+/**
+  * @brief  formats the deferred logs recorded since the last call
+  * @param  null
+  * @retval null
+  */
+static void cli_log_handle(void)
+{
+	static uint32_t reported = 0;
+	uintptr_t record[3 + CLI_LOG_MAX_ARGS] = {0};
+
+	/* a record is published at once, its arguments are there as soon as its header is */
+	while(shell_queue_out_bulk(&cli_log_ring, (uint8_t *)record, 3 * sizeof(uintptr_t)) != 0){
+		uint8_t nargs = (record[0] >> 8) & 0xFF;
+
+		shell_queue_out_bulk(&cli_log_ring, (uint8_t *)&record[3], nargs * sizeof(uintptr_t));
+#ifdef CLI_TIMESTAMP
+		cli_timestamp_print(stdout, record[2]);
+		printf(CLI_FONT_CYAN "[%s]: ", cli_logs_names[record[0] & 0xFF]);
+#else
+		printf(CLI_FONT_CYAN "[%s %lu]: ", cli_logs_names[record[0] & 0xFF], (unsigned long)record[2]);
+#endif
+		printf((const char *)record[1], record[3], record[4], record[5], record[6], record[7], record[8]);
+		printf(CLI_FONT_DEFAULT);
+		memset(&record[3], 0, nargs * sizeof(uintptr_t));
+	}
+
+	uint32_t dropped = cli_log_dropped;
+	if(dropped != reported){
+		printf(CLI_FONT_RED "[LOG]: %lu records dropped, the ring is full." CLI_FONT_DEFAULT,
+				(unsigned long)(dropped - reported));NL1();
+		reported = dropped;
+	}
+}
+#endif /* CLI_LOG_DEFERRED */
+
+#ifdef CLI_TIMESTAMP
+void cli_timestamp_print(FILE *stream, uint32_t ts)
+{
+	static uint32_t last = 0;		/* newest timestamp printed */
+	static uint32_t wraps = 0;		/* times the counter wrapped before it */
+	static bool started = false;
+	uint64_t t;
+	char sign = '+';
+
+	/* the deferred logs can be printed after newer timestamps: the timestamps are ordered
+	 * by their distance to the newest one, and at least one is needed per half period to
+	 * count the wraps */
+	CLI_ENTER_CRITICAL();
+	if(!started){
+		last = ts;
+		started = true;
+	}
+	int32_t delta = (int32_t)(ts - last);
+	uint32_t period = wraps;
+	if(delta >= 0){
+		wraps += (ts < last);
+		period = wraps;
+		last = ts;
+	}else if(ts > last){
+		period--;
+	}
+	CLI_EXIT_CRITICAL();
+
+	if(cli_timestamp_mode == CLI_TIME_OFF){
+		return;
+	}else if(cli_timestamp_mode == CLI_TIME_REL){
+		sign = (delta >= 0) ? '+' : '-';
+		t = (delta >= 0) ? (uint32_t)delta : -(int64_t)delta;
+	}else{
+		sign = ' ';
+		t = ((uint64_t)period << 32) | ts;
+	}
+
+	uint32_t freq = CLI_TIMESTAMP_FREQ;
+	fprintf(stream, CLI_FONT_DEFAULT "[%c%5lu.%06lu] ", sign,
+			(unsigned long)(t / freq), (unsigned long)((t % freq) * 1000000 / freq));
+}
+#endif /* CLI_TIMESTAMP */
+
+/**
+  * @brief  		adds the tokens earned since the last refill to a rate limit
+  * @param  limit:	rate limit of a category, with a rate
+  * @param  now:	current tick
+  * @retval null
+  */
+static void cli_log_refill(LOG_RATE_S *limit, uint32_t now)
+{
+	uint32_t elapsed = now - limit->last;
+
+	if(elapsed >= 1000){
+		limit->tokens = limit->rate;
+		limit->last = now;
+		return;
+	}
+
+	uint32_t earned = elapsed * limit->rate / 1000;
+	if(earned != 0){
+		limit->tokens = (limit->tokens + earned < limit->rate) ? limit->tokens + earned : limit->rate;
+		/* only the time of the earned tokens is consumed, the fraction of token is kept */
+		limit->last += earned * 1000 / limit->rate;
+	}
+}
+
+/**
+  * @brief  		prints the number of LOGs of a category that were suppressed
+  */
+static void cli_log_report(uint8_t cat, uint32_t suppressed)
+{
+#ifdef CLI_LOG_DEFERRED
+	uintptr_t arg = suppressed;
+	cli_log_defer(cat, "%lu messages suppressed\n", 1, &arg);
+#else
+	CLI_TIMESTAMP_PRINT(stdout);
+	printf(CLI_FONT_CYAN "[%s]: %lu messages suppressed\n" CLI_FONT_DEFAULT,
+			cli_logs_names[cat], (unsigned long)suppressed);
+#endif
+}
+
+uint8_t cli_log_allow(uint8_t cat)
+{
+	LOG_RATE_S *limit = &cli_log_rates[cat];
+	uint32_t report = 0;
+	uint8_t allow;
+
+	if(limit->rate == 0){
+		return true;
+	}
+
+	CLI_ENTER_CRITICAL();
+	cli_log_refill(limit, HAL_GetTick());
+	allow = (limit->tokens != 0);
+	if(allow){
+		limit->tokens--;
+		report = limit->suppressed;
+		limit->suppressed = 0;
+	}else{
+		limit->suppressed++;
+		limit->dropped++;
+	}
+	CLI_EXIT_CRITICAL();
+
+	if(report != 0){
+		cli_log_report(cat, report);
+	}
+	return allow;
+}
+
+/**
+  * @brief  reports the LOGs suppressed in the categories that are quiet again
+  * @param  null
+  * @retval null
+  */
+static void cli_log_rate_handle(void)
+{
+	for(uint8_t i = 0; i < CLI_LAST_LOG_CATEGORY; i++){
+		LOG_RATE_S *limit = &cli_log_rates[i];
+		uint32_t report = 0;
+
+		if(limit->suppressed == 0){
+			continue;
+		}
+
+		CLI_ENTER_CRITICAL();
+		if(limit->rate != 0){
+			cli_log_refill(limit, HAL_GetTick());
+		}
+		if(limit->rate == 0 || limit->tokens != 0){
+			limit->tokens -= (limit->rate != 0);
+			report = limit->suppressed;
+			limit->suppressed = 0;
+		}
+		CLI_EXIT_CRITICAL();
+
+		if(report != 0){
+			cli_log_report(i, report);
+		}
+	}
+}
+
+/**
+  * @brief  		handles the characters received, the running command and the
+  * 				transmission of a context, and the logs for cli_console
+  * @param  ctx:	context
+  * @retval null
+  */
+static void cli_ctx_run(cli_ctx_s *ctx)
+{
+    cli_ctx_select(ctx);
+#ifdef CLI_RX_DMA
+    if(ctx->rx_lapped){
+    	/* the bytes not read were overwritten by the DMA: the queue restarts at its position */
+    	CLI_ENTER_CRITICAL();
+    	ctx->stats.rx_dropped += shell_queue_count(&ctx->rx_buff);
+    	ctx->rx_buff.Rear += (ctx->rx_dma_pos - ctx->rx_buff.Rear) & ctx->rx_buff.Mask;
+    	ctx->rx_buff.Front = ctx->rx_buff.Rear;
+    	ctx->rx_lapped = false;
+    	CLI_EXIT_CRITICAL();
+    }
+#endif
+    cli_rx_handle(ctx);
+    if(ctx->job.running){
+    	cli_job_handle(ctx);
+    }
+#ifdef CLI_RX_DMA
+    if(ctx->rx_rearm){
+    	/* the DMA is stopped and what it received has been read: it restarts from the start */
+    	CLI_ENTER_CRITICAL();
+    	ctx->rx_rearm = false;
+    	ctx->rx_buff.Front = ctx->rx_buff.Rear = 0;
+    	ctx->rx_dma_pos = 0;
+    	cli_rx_start(ctx);
+    	CLI_EXIT_CRITICAL();
+    }
+#endif
+    if(ctx == &cli_console){
+    	cli_log_rate_handle();
+#ifdef CLI_LOG_DEFERRED
+    	cli_log_handle();
+#endif
+    }
+    cli_tx_handle(ctx);
 }
 
-/*
- * Callback function for UART IRQ when it is done transmitting data
- */
-void HAL_UART_TxCpltCallback(UART_HandleTypeDef * huart){
-	cli_tx_isr_flag = false;
+void cli_run(void)
+{
+	for(cli_ctx_s *ctx = &cli_console; ctx != NULL; ctx = ctx->next){
+		cli_ctx_run(ctx);
+	}
+	/* what is printed outside of cli_run goes to the console */
+	cli_ctx_select(&cli_console);
 }
 
-/**
-  * @brief  handle commands from the terminal
-  * @param  commands
-  * @retval null
-  */
-static void cli_rx_handle(shell_queue_s *rx_buff)
-{
-    static HANDLE_TYPE_S Handle = {.len = 0, .buff = {0}};
-    uint8_t i = Handle.len;
-    uint8_t cmd_match = false;
-    uint8_t exec_req = false;
-
-    /*  ---------------------------------------
-        Step1: save chars from the terminal
-        ---------------------------------------
-     */
-    bool newChar = true;
-    while(newChar) {
-        if(Handle.len < MAX_LINE_LEN) {  /* check the buffer */
-        	newChar = shell_queue_out(rx_buff, Handle.buff+Handle.len);
-
-            /* new char coming from the terminal, copy it to Handle.buff */
-            if(newChar) {
-                /* KEY_BACKSPACE -->get DELETE key from keyboard */
-                if (Handle.buff[Handle.len] == KEY_BACKSPACE || Handle.buff[Handle.len] == KEY_DEL) {
-                    /* buffer not empty */
-                    if (Handle.len > 0) {
-                        /* delete a char in terminal */
-                        TERMINAL_MOVE_LEFT(1);
-                        TERMINAL_CLEAR_END();
-                        Handle.buff[Handle.len] = '\0';
-                        Handle.len--;
-                    }
-
-                } else if(Handle.buff[Handle.len] == KEY_ENTER){
-                	exec_req = true;
-                	Handle.len++;
-                }else if(strstr((const char *)Handle.buff, KEY_DELETE) != NULL){
-                	strcpy((char *)&Handle.buff[Handle.len-3], (char *)&Handle.buff[Handle.len+1]);
-                	Handle.len -= 3;
-            	}else{
-                    Handle.len++;
-                }
-
-            } else if(cli_password_ok){
-                /* all chars copied to Handle.buff */
-                uint8_t key = 0;
-                uint8_t err = 0xff;
-                char *p_hist_cmd = 0;
-
-                if (Handle.len >= 3) {
-                    if (strstr((const char *)Handle.buff, KEY_UP) != NULL) {
-                        key = 1;
-                        TERMINAL_MOVE_LEFT(Handle.len-3);
-                        TERMINAL_CLEAR_END();
-                        err = cli_history_show(true, &p_hist_cmd);
-                    } else if (strstr((const char *)Handle.buff, KEY_DOWN) != NULL) {
-                        key = 2;
-                        TERMINAL_MOVE_LEFT(Handle.len-3);
-                        TERMINAL_CLEAR_END();
-                        err = cli_history_show(false, &p_hist_cmd);
-                    } else if (strstr((const char *)Handle.buff, KEY_RIGHT) != NULL) {
-                        key = 3;
-                    } else if (strstr((const char *)Handle.buff, KEY_LEFT) != NULL) {
-                        key = 4;
-                    }
-
-                    if (key != 0) {
-                        if (!err) {
-                            memset(&Handle, 0x00, sizeof(Handle));
-                            memcpy(Handle.buff, p_hist_cmd, strlen(p_hist_cmd));
-                            Handle.len = strlen(p_hist_cmd);
-                            Handle.buff[Handle.len] = '\0';
-                            printf("%s", Handle.buff);  /* display history command */
-                        } else if (err && (0 != key)) {
-                            /* no history found */
-                            TERMINAL_MOVE_LEFT(Handle.len-3);
-                            TERMINAL_CLEAR_END();
-                            memset(&Handle, 0x00, sizeof(Handle));
-                        }
-                    }
-                }
-
-                if ((key == 0) && (Handle.len > i)) {
-                    /* display char in terminal */
-                    for (; i < Handle.len; i++) {
-                    	printf("%c", Handle.buff[i]);
-
-                    }
-                }
-                break;
-            }
+uint8_t cli_pending(void)
+{
+	uint8_t pending = 0;
 
-        } else {
-            /* buffer full */
-            break;
-        } /*end if(Handle.len > HANDLE_LEN) */
-    } /* end While(1) */
-
-    /*  ---------------------------------------
-        Step2: handle the commands
-        ---------------------------------------
-     */
-    if(exec_req && !cli_password_ok){
-#ifdef CLI_PASSWORD
-    	Handle.buff[Handle.len-1] = '\0';
-    	if(strcmp((char *)Handle.buff, XSTRING(CLI_PASSWORD)) == 0){
-    		cli_password_ok = true;
-    		greet();
-    	}
-    	Handle.len = 0;
+	for(cli_ctx_s *ctx = &cli_console; ctx != NULL; ctx = ctx->next){
+#ifdef CLI_RX_DMA
+		if(!shell_queue_empty(&ctx->rx_buff) || ctx->rx_rearm || ctx->rx_lapped){
 #else
-    	cli_password_ok = true;
-    	greet();
+		if(!shell_queue_empty(&ctx->rx_buff)){
 #endif
-    }else if(exec_req && (Handle.len == 1)) {
-        /* KEY_ENTER -->ENTER key from terminal */
-    	PRINT_CLI_NAME();
-        Handle.len = 0;
-    } else if(exec_req && Handle.len > 1) {  /* check for the length of command */
-		NL1();
-		Handle.buff[Handle.len - 1] = '\0';
-		cli_history_add((char *)Handle.buff);
-		char *command = strtok((char *)Handle.buff, " \t");
-
-		/* looking for a match */
-		for(i = 0; i < MAX_COMMAND_NB; i++) {
-			if(0 == strcmp(command, CLI_commands[i].pCmd)) {
-				cmd_match = true;
-
-				//Split arguments string to argc/argv
-				uint8_t argc = 1;
-				char 	*argv[MAX_ARGC];
-				argv[0] = command;
-
-				char *token = strtok(NULL, " \t");
-				while(token != NULL){
-					if(argc >= MAX_ARGC){
-						printf(CLI_FONT_RED "Maximum number of arguments is %d. Ignoring the rest of the arguments."CLI_FONT_DEFAULT, MAX_ARGC-1);NL1();
-						break;
-					}
-					argv[argc] = token;
-					argc++;
-					token = strtok(NULL, " \t");
-				}
-
-				if(CLI_commands[i].pFun != NULL) {
-					/* call the func. */
-					TERMINAL_HIDE_CURSOR();
-					uint8_t result = CLI_commands[i].pFun(argc, argv);
-
-					if(result == EXIT_SUCCESS){
-						printf(CLI_FONT_GREEN "(%s returned %d)" CLI_FONT_DEFAULT, command, result);NL1();
-					}else{
-						printf(CLI_FONT_RED "(%s returned %d)" CLI_FONT_DEFAULT, command, result);NL1();
-					}
-					TERMINAL_SHOW_CURSOR();
-					break;
-				} else {
-					/* func. is void */
-					printf(CLI_FONT_RED "Command %s exists but no function is associated to it.", command);NL1();
-				}
-			}
+			pending |= CLI_PENDING_RX;
 		}
-
-		if(!cmd_match) {
-			/* no matching command */
-			printf("\r\nCommand \"%s\" unknown, try: help", Handle.buff);NL1();
+		if(ctx->job.running){
+			pending |= CLI_PENDING_JOB;
 		}
-
-		Handle.len = 0;
-		PRINT_CLI_NAME();
-
-    }
-
-
-    if(Handle.len >= MAX_LINE_LEN) {
-        /* full, so restart the count */
-    	printf(CLI_FONT_RED "\r\nMax command length is %d.\r\n" CLI_FONT_DEFAULT, MAX_LINE_LEN-1);
-    	PRINT_CLI_NAME();
-        Handle.len = 0;
-    }
+		if(ctx->tx_xfer != 0){
+			pending |= CLI_PENDING_TX;
+		}else if(!shell_queue_empty(&ctx->tx_buff)){
+			/* refused by the transport, retried by the next cli_run */
+			pending |= CLI_PENDING_TIMER;
+		}
+	}
+#ifdef CLI_LOG_DEFERRED
+	if(!shell_queue_empty(&cli_log_ring)){
+		pending |= CLI_PENDING_LOG;
+	}
+#endif
+	if(__fpending(stdout) != 0){
+		pending |= CLI_PENDING_OUTPUT;
+	}
+	/* suppressed LOGs are reported once their category is under its limit again */
+	for(size_t i = 0; i < CLI_LAST_LOG_CATEGORY; i++){
+		if(cli_log_rates[i].suppressed != 0){
+			pending |= CLI_PENDING_TIMER;
+			break;
+		}
+	}
+	return pending;
 }
 
-
-/**
-  * @brief  tx handle, flushes stdout buffer
-  * @param  null
-  * @retval null
-  */
-static void cli_tx_handle(void)
+#if CLI_OS != CLI_OS_NONE
+void cli_task(void *argument)
 {
-    fflush(stdout);
+	cli_os_init();
+	cli_init((UART_HandleTypeDef *)argument);
+	cli_task_setup();
+
+	for(;;){
+		cli_run();
+		/* the events wake the task up, only the delayed work needs a timeout */
+		uint8_t pending = cli_pending();
+		if(pending & (CLI_PENDING_RUN & ~CLI_PENDING_JOB)){
+			continue;
+		}
+		if(pending & CLI_PENDING_JOB){
+			/* a running command has used its budget, the other tasks get the time between the calls */
+			cli_os_wait(CLI_OS_JOB_MS);
+		}else{
+			cli_os_wait((pending & CLI_PENDING_TIMER) ? CLI_OS_POLL_MS : CLI_OS_FOREVER);
+		}
+	}
 }
 
-void cli_run(void)
+__attribute__((weak)) void cli_task_setup(void)
+{
+}
+#else
+__attribute__((weak)) void cli_wake_hook(void)
 {
-    cli_rx_handle(&cli_rx_buff);
-    cli_tx_handle();
 }
+#endif /* CLI_OS != CLI_OS_NONE */
 
 void greet(void){
     NL1();
@@ -554,22 +2086,33 @@ void greet(void){
 uint8_t cli_help(int argc, char *argv[])
 {
 	if(argc == 1){
-	    for(size_t i = 0; i < MAX_COMMAND_NB; i++) {
-	    	if(strcmp(CLI_commands[i].pCmd, "") != 0){
-		    	printf("[%s]", CLI_commands[i].pCmd);NL1();
-		        if (CLI_commands[i].pHelp) {
-		            printf(CLI_commands[i].pHelp);NL2();
-		        }
+		/* both tables are sorted (the CLI_COMMAND one if its index is generated): they
+		 * are merged to list the commands in name order */
+	    for(size_t i = 0, j = 0; i < cli_static_commands_nb() || j < cli_commands_nb;) {
+	    	const COMMAND_S *cmd = (i < cli_static_commands_nb()) ? cli_static_command(i) : NULL;
+	    	if(i < cli_static_commands_nb() && cmd == NULL){
+	    		i++;		/* not built in this configuration */
+	    		continue;
 	    	}
+	    	if(cmd != NULL && (j == cli_commands_nb || strcmp(cmd->pCmd, CLI_commands[j].pCmd) < 0)){
+	    		i++;
+	    	}else{
+	    		cmd = &CLI_commands[j++];
+	    	}
+	    	printf("[%s]", cmd->pCmd);NL1();
+	        if (cmd->pHelp) {
+	            printf(cmd->pHelp);NL2();
+	        }
 	    }
 	    return EXIT_SUCCESS;
 	}else if(argc == 2){
-	    for(size_t i = 0; i < MAX_COMMAND_NB; i++) {
-	    	if(strcmp(CLI_commands[i].pCmd, argv[1]) == 0){
-		    	printf("[%s]", CLI_commands[i].pCmd);NL1();
-	    		printf(CLI_commands[i].pHelp);NL1();
-	    		return EXIT_SUCCESS;
+		const COMMAND_S *cmd = cli_command_find(argv[1]);
+	    if(cmd != NULL){
+	    	printf("[%s]", cmd->pCmd);NL1();
+	    	if (cmd->pHelp) {
+	    		printf(cmd->pHelp);NL1();
 	    	}
+	    	return EXIT_SUCCESS;
 	    }
 	    printf("No help found for command %s.", argv[1]);NL1();
 	    return EXIT_FAILURE;
@@ -622,23 +2165,98 @@ uint8_t cli_reset(int argc, char *argv[])
 }
 
 void cli_add_command(const char *command, const char *help, uint8_t (*exec)(int argc, char *argv[])){
-	size_t i = 0;
-	for(; i < MAX_COMMAND_NB; i++){
-		if(strcmp(CLI_commands[i].pCmd, "") == 0){
-			CLI_commands[i].pCmd = command;
-			CLI_commands[i].pFun = exec;
-			CLI_commands[i].pHelp = help;
-			break;
+	size_t pos = cli_command_lower_bound(false, command, SIZE_MAX);
+
+	if(cli_static_command_find(command) != NULL
+			|| (pos < cli_commands_nb && strcmp(CLI_commands[pos].pCmd, command) == 0)){
+		ERR("Cannot add command %s, a command with the same name already exists.\n", command);
+		return;
+	}
+
+	if(cli_commands_nb == cli_commands_size){
+		/* grow the table, doubling its size */
+		size_t size = (cli_commands_size == 0) ? CLI_COMMANDS_INIT_NB : 2 * cli_commands_size;
+		COMMAND_S *commands = realloc(CLI_commands, size * sizeof(COMMAND_S));
+		if(commands == NULL){
+			ERR("Cannot add command %s, not enough memory to grow the table of %u commands.\n",
+					command, (unsigned int)cli_commands_nb);
+			return;
+		}
+		CLI_commands = commands;
+#if CLI_CMD_PROFILE
+		CMD_STATS_S *stats = realloc(cli_commands_stats, size * sizeof(CMD_STATS_S));
+		if(stats == NULL){
+			ERR("Cannot add command %s, not enough memory to grow the table of %u commands.\n",
+					command, (unsigned int)cli_commands_nb);
+			return;
 		}
+		cli_commands_stats = stats;
+#endif
+		cli_commands_size = size;
 	}
-	if(i == MAX_COMMAND_NB){
-		ERR("Cannot add command %s, max number of commands "
-				"reached. The maximum number of command is set to %d.\n" CLI_FONT_DEFAULT,
-				command, MAX_COMMAND_NB); NL1();
+
+	/* insert the command at its place in name order */
+	memmove(&CLI_commands[pos + 1], &CLI_commands[pos], (cli_commands_nb - pos) * sizeof(COMMAND_S));
+	CLI_commands[pos].pCmd = command;
+	CLI_commands[pos].pFun = exec;
+	CLI_commands[pos].pHelp = help;
+	CLI_commands[pos].pComplete = NULL;
+	CLI_commands[pos].pStats = NULL;
+	cli_commands_nb++;
+#if CLI_CMD_PROFILE
+	/* the statistics move with their command, the table may have moved too */
+	memmove(&cli_commands_stats[pos + 1], &cli_commands_stats[pos], (cli_commands_nb - 1 - pos) * sizeof(CMD_STATS_S));
+	memset(&cli_commands_stats[pos], 0, sizeof(CMD_STATS_S));
+	for(size_t i = 0; i < cli_commands_nb; i++){
+		CLI_commands[i].pStats = &cli_commands_stats[i];
 	}
+#endif
+
 	LOG(CLI_LOG_SHELL, "Command %s added to shell.\n", command);
 }
 
+void cli_add_completion(const char *command, const char *(*complete)(int argc, char *argv[], size_t index)){
+	size_t pos = cli_command_lower_bound(false, command, SIZE_MAX);
+
+	if(pos < cli_commands_nb && strcmp(CLI_commands[pos].pCmd, command) == 0){
+		CLI_commands[pos].pComplete = complete;
+	}else if(cli_static_command_find(command) != NULL){
+		ERR("Cannot add a completion to command %s, declare it with CLI_COMMAND_COMPLETE instead.\n", command);
+	}else{
+		ERR("Cannot add a completion to command %s, the command does not exist.\n", command);
+	}
+}
+
+/**
+  * @brief  completion of the help arguments: the commands
+  */
+const char *cli_help_complete(int argc, char *argv[], size_t index){
+	return (argc == 2) ? cli_complete_candidate(1, &argv[1], index) : NULL;
+}
+
+/**
+  * @brief  completion of the log arguments: the subcommands, then the categories
+  */
+const char *cli_log_complete(int argc, char *argv[], size_t index){
+	static const char *const subcommands[] = {"on", "off", "show", "rate", "time"};
+	static const char *const modes[] = {"off", "abs", "rel"};
+
+	if(argc == 2){
+		return (index < sizeof(subcommands) / sizeof(subcommands[0])) ? subcommands[index] : NULL;
+	}
+	if(strcmp(argv[1], "time") == 0){
+		return (argc == 3 && index < sizeof(modes) / sizeof(modes[0])) ? modes[index] : NULL;
+	}
+	if(strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0
+			&& (strcmp(argv[1], "rate") != 0 || argc != 3)){
+		return NULL;
+	}
+	if(index == 0){
+		return "all";
+	}
+	return (index - 1 < CLI_LAST_LOG_CATEGORY) ? cli_logs_names[index - 1] : NULL;
+}
+
 uint8_t cli_log(int argc, char *argv[]){
 	if(argc < 2){
 		printf("Command %s takes at least one argument. Use \"help %s\" for usage.\n", argv[0], argv[0]);
@@ -681,11 +2299,60 @@ uint8_t cli_log(int argc, char *argv[]){
 	}else if(strcmp(argv[1], "show") == 0){
 		for(unsigned int i = 0; i < CLI_LAST_LOG_CATEGORY; i++){
 			printf("%16s:\t", cli_logs_names[i]);
-			if(cli_log_stat&(1<<i)){
-				printf(CLI_FONT_GREEN"Enabled"CLI_FONT_DEFAULT"\n");
+			if(!CLI_LOG_COMPILED(i) || CLI_LOG_LEVEL > CLI_LEVEL_LOG){
+				printf(CLI_FONT_YELLOW"%-12s"CLI_FONT_DEFAULT, "Compiled out");
+			}else if(cli_log_stat&(1<<i)){
+				printf(CLI_FONT_GREEN"%-12s"CLI_FONT_DEFAULT, "Enabled");
 			}else{
-				printf(CLI_FONT_RED"Disabled"CLI_FONT_DEFAULT"\n");
+				printf(CLI_FONT_RED"%-12s"CLI_FONT_DEFAULT, "Disabled");
 			}
+			if(cli_log_rates[i].rate != 0){
+				printf("  limit %5u/s", cli_log_rates[i].rate);
+			}else{
+				printf("  no limit    ");
+			}
+			printf("  %lu suppressed\n", (unsigned long)cli_log_rates[i].dropped);
+		}
+#ifdef CLI_TIMESTAMP
+		static const char *const modes[] = {"off", "absolute", "relative"};
+		printf("%16s:\t%s\n", "Timestamps", modes[cli_timestamp_mode]);
+#endif
+		return EXIT_SUCCESS;
+
+	}else if(strcmp(argv[1], "time") == 0){
+#ifdef CLI_TIMESTAMP
+		if(argc == 3 && strcmp(argv[2], "off") == 0){
+			cli_timestamp_mode = CLI_TIME_OFF;
+		}else if(argc == 3 && strcmp(argv[2], "abs") == 0){
+			cli_timestamp_mode = CLI_TIME_ABS;
+		}else if(argc == 3 && strcmp(argv[2], "rel") == 0){
+			cli_timestamp_mode = CLI_TIME_REL;
+		}else{
+			printf("Command %s time takes one argument: off, abs or rel.\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+#else
+		printf("The timestamps are not compiled in, define CLI_TIMESTAMP.\n");
+		return EXIT_FAILURE;
+#endif
+
+	}else if(strcmp(argv[1], "rate") == 0){
+		char *end;
+		unsigned long rate = (argc == 4) ? strtoul(argv[3], &end, 10) : 0;
+
+		if(argc != 4 || end == argv[3] || (*end != '\0' && strcmp(end, "/s") != 0) || rate > UINT16_MAX){
+			printf("Command %s rate takes a category (or all) and a number of logs per second.\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		if(!cli_log_rate_set(argv[2], (uint16_t)rate)){
+			printf("Unknown log category %s.\n", argv[2]);
+			return EXIT_FAILURE;
+		}
+		if(rate != 0){
+			printf("Logs of %s limited to %lu per second.\n", argv[2], rate);
+		}else{
+			printf("Logs of %s not limited.\n", argv[2]);
 		}
 		return EXIT_SUCCESS;
 	}
@@ -693,6 +2360,28 @@ uint8_t cli_log(int argc, char *argv[]){
 	return EXIT_FAILURE;
 }
 
+/**
+  * @brief  		sets the rate limit of a log category
+  * @param  cat:	name of the category, "all" for all of them
+  * @param  rate:	LOGs per second, 0 for no limit
+  * @retval 		true, false if the category does not exist
+  */
+static uint8_t cli_log_rate_set(const char *cat, uint16_t rate){
+	uint8_t found = false;
+
+	for(unsigned int i = 0; i < CLI_LAST_LOG_CATEGORY; i++){
+		if(strcmp(cat, "all") == 0 || strcmp(cat, cli_logs_names[i]) == 0){
+			CLI_ENTER_CRITICAL();
+			cli_log_rates[i].rate = rate;
+			cli_log_rates[i].tokens = rate;
+			cli_log_rates[i].last = HAL_GetTick();
+			CLI_EXIT_CRITICAL();
+			found = true;
+		}
+	}
+	return found;
+}
+
 void cli_disable_log_entry(char *str){
 	for(unsigned int i = 0; i < CLI_LAST_LOG_CATEGORY; i++){
 		if(strcmp(str, cli_logs_names[i]) == 0){
@@ -710,3 +2399,420 @@ void cli_enable_log_entry(char *str){
 		}
 	}
 }
+
+/**
+  * @brief  completion of the commands whose only argument is "reset"
+  */
+const char *cli_reset_complete(int argc, char *argv[], size_t index){
+	(void)argv;
+	return (argc == 2 && index == 0) ? "reset" : NULL;
+}
+
+/**
+  * @brief  shows the health counters of the shell, or resets them
+  * @param  para addr. & length
+  * @retval True means OK
+  */
+uint8_t cli_show_stats(int argc, char *argv[]){
+	cli_ctx_s *ctx = cli_ctx_current;
+	CLI_STATS_S stats;
+
+	if(argc == 2 && strcmp(argv[1], "reset") == 0){
+		CLI_ENTER_CRITICAL();
+		memset(&ctx->stats, 0, sizeof(ctx->stats));
+		CLI_EXIT_CRITICAL();
+		printf("Counters reset.\n");
+		return EXIT_SUCCESS;
+	}
+	if(argc != 1){
+		printf("Command %s takes no argument or \"reset\".\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* a consistent copy, the interrupts update them */
+	CLI_ENTER_CRITICAL();
+	stats = ctx->stats;
+	CLI_EXIT_CRITICAL();
+
+	printf("RX    %10lu bytes  %10lu dropped  queue max %lu/%lu\n",
+			(unsigned long)stats.rx_bytes, (unsigned long)stats.rx_dropped,
+			(unsigned long)stats.rx_high_water, (unsigned long)(ctx->rx_buff.Mask + 1));
+	printf("UART  %10lu overrun  %10lu framing  %lu noise  %lu parity  %lu DMA\n",
+			(unsigned long)stats.uart_overrun, (unsigned long)stats.uart_framing,
+			(unsigned long)stats.uart_noise, (unsigned long)stats.uart_parity,
+			(unsigned long)stats.uart_dma);
+	printf("TX    %10lu bytes  %10lu dropped  ring max %lu/%lu  blocked %lu ms  %lu errors\n",
+			(unsigned long)stats.tx_bytes, (unsigned long)stats.tx_dropped,
+			(unsigned long)stats.tx_high_water, (unsigned long)(ctx->tx_buff.Mask + 1),
+			(unsigned long)stats.tx_blocked_ms, (unsigned long)stats.tx_errors);
+	printf("Lines %10lu truncated (max %d chars)\n",
+			(unsigned long)stats.lines_truncated, MAX_LINE_LEN - 1);
+	printf("RAM   %10lu bytes (history %u)\n",
+			(unsigned long)CLI_CTX_RAM(ctx->rx_buff.Mask + 1, ctx->tx_buff.Mask + 1, ctx->history.size),
+			ctx->history.size);
+	return EXIT_SUCCESS;
+}
+
+#if CLI_CMD_PROFILE
+/* unit of CLI_TIMESTAMP_GET() */
+#ifdef CLI_TIMESTAMP_DWT
+static const char		cli_profile_unit[]			= "cycles";
+#else
+static const char		cli_profile_unit[]			= "counts";
+#endif
+
+/**
+  * @brief  completion of the time arguments: the command to run, then its own arguments
+  */
+const char *cli_time_complete(int argc, char *argv[], size_t index){
+	return (argc >= 2) ? cli_complete_candidate(argc - 1, &argv[1], index) : NULL;
+}
+
+/**
+  * @brief  runs a command and shows the time it took
+  * @param  para addr. & length
+  * @retval what the command returned
+  */
+uint8_t cli_time(int argc, char *argv[]){
+	if(argc < 2){
+		printf("Command %s takes the command to run. Use \"help %s\" for usage.\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+	const COMMAND_S *cmd = cli_command_find(argv[1]);
+	if(cmd == NULL || cmd->pFun == NULL){
+		printf("Command \"%s\" unknown, try: help\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	static uint32_t job_tick;		/* cooperative command: tick of its first call, one timed at a time for all the contexts */
+	static uint64_t job_count;		/* and counts spent in its calls */
+	uint32_t tick = HAL_GetTick();
+	uint32_t start = CLI_TIMESTAMP_GET();
+	if(!cli_ctx_current->job.running){
+		job_tick = tick;
+		job_count = 0;
+	}
+	uint8_t result = cli_command_exec(cmd, argc - 1, &argv[1]);
+	uint32_t count = CLI_TIMESTAMP_GET() - start;
+	tick = HAL_GetTick() - tick;
+	job_count += count;
+
+	if(CLI_NOT_DONE(result)){
+		/* time is resumed with it, until it is done */
+		return result;
+	}
+	if(cli_ctx_current->job.running){
+		uint32_t us = (uint32_t)(job_count * 1000000U / CLI_TIMESTAMP_FREQ);
+		printf("%s: %lu ms, %lu.%03lu ms in its calls\n", argv[1], (unsigned long)(HAL_GetTick() - job_tick),
+				(unsigned long)(us / 1000), (unsigned long)(us % 1000));
+	}else if(tick < 1000){
+		/* the counter can wrap within seconds: the tick takes over for the long commands */
+		uint32_t us = (uint32_t)((uint64_t)count * 1000000U / CLI_TIMESTAMP_FREQ);
+		printf("%s: %lu.%03lu ms, %lu %s\n", argv[1], (unsigned long)(us / 1000),
+				(unsigned long)(us % 1000), (unsigned long)count, cli_profile_unit);
+	}else{
+		printf("%s: %lu ms\n", argv[1], (unsigned long)tick);
+	}
+	return result;
+}
+
+/**
+  * @brief  		prints the statistics of a command, if it has been called
+  */
+static void cli_cmdstats_print(const COMMAND_S *cmd)
+{
+	const CMD_STATS_S *stats = cmd->pStats;
+
+	if(stats == NULL || stats->calls == 0){
+		return;
+	}
+	printf("%-16s %8lu %10lu %10lu %10lu %9lu %4u\n", cmd->pCmd, (unsigned long)stats->calls,
+			(unsigned long)(stats->total / stats->calls), (unsigned long)stats->min,
+			(unsigned long)stats->max,
+			(unsigned long)((uint64_t)stats->max * 1000000U / CLI_TIMESTAMP_FREQ), stats->result);
+}
+
+/**
+  * @brief  shows the statistics of the commands called, or resets them
+  * @param  para addr. & length
+  * @retval True means OK
+  */
+uint8_t cli_cmdstats(int argc, char *argv[]){
+	if(argc == 2 && strcmp(argv[1], "reset") == 0){
+		for(size_t i = 0; i < cli_static_commands_nb(); i++){
+			if(cli_static_command(i) != NULL && cli_static_command(i)->pStats != NULL){
+				memset(cli_static_command(i)->pStats, 0, sizeof(CMD_STATS_S));
+			}
+		}
+		if(cli_commands_stats != NULL){
+			/* allocated with the first command added at runtime */
+			memset(cli_commands_stats, 0, cli_commands_nb * sizeof(CMD_STATS_S));
+		}
+		printf("Statistics reset.\n");
+		return EXIT_SUCCESS;
+	}
+	if(argc != 1){
+		printf("Command %s takes no argument or \"reset\".\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("command             calls %10s %10s %10s  max (us) last\n", "avg", "min", "max");
+	for(size_t i = 0; i < cli_static_commands_nb(); i++){
+		if(cli_static_command(i) != NULL){
+			cli_cmdstats_print(cli_static_command(i));
+		}
+	}
+	for(size_t i = 0; i < cli_commands_nb; i++){
+		cli_cmdstats_print(&CLI_commands[i]);
+	}
+	printf("(times in %s of CLI_TIMESTAMP_GET, the current call of cmdstats is not counted)\n", cli_profile_unit);
+	return EXIT_SUCCESS;
+}
+#endif /* CLI_CMD_PROFILE */
+
+#ifdef CLI_LATENCY
+/**
+  * @brief  		upper bound of a bucket of the latency histogram
+  * @param  bucket:	index of the bucket
+  * @retval 		in microseconds, rounded up
+  */
+static uint32_t cli_latency_bound_us(uint8_t bucket)
+{
+	return (uint32_t)(((2ULL << bucket) * 1000000U + CLI_TIMESTAMP_FREQ - 1) / CLI_TIMESTAMP_FREQ);
+}
+
+/**
+  * @brief  shows the histogram of the echo latency, or resets it
+  * @param  para addr. & length
+  * @retval True means OK
+  */
+uint8_t cli_show_latency(int argc, char *argv[]){
+	uint32_t histogram[CLI_LATENCY_BUCKETS];
+	uint32_t total = 0;
+	uint32_t max = 0;
+
+	if(argc == 2 && strcmp(argv[1], "reset") == 0){
+		memset(cli_ctx_current->latency, 0, sizeof(cli_ctx_current->latency));
+		cli_ctx_current->echo_nb = 0;
+		printf("Histogram reset.\n");
+		return EXIT_SUCCESS;
+	}
+	if(argc != 1){
+		printf("Command %s takes no argument or \"reset\".\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* copied first: printing adds the bytes of this command line */
+	memcpy(histogram, cli_ctx_current->latency, sizeof(histogram));
+	for(uint8_t i = 0; i < CLI_LATENCY_BUCKETS; i++){
+		total += histogram[i];
+		max = (histogram[i] > max) ? histogram[i] : max;
+	}
+	if(total == 0){
+		printf("No byte received yet.\n");
+		return EXIT_SUCCESS;
+	}
+
+	printf("latency (us)      bytes\n");
+	uint32_t count = 0;
+	uint32_t p50 = 0, p99 = 0;
+	for(uint8_t i = 0; i < CLI_LATENCY_BUCKETS; i++){
+		if(histogram[i] == 0){
+			continue;
+		}
+		count += histogram[i];
+		if(p50 == 0 && count >= (total + 1) / 2){
+			p50 = cli_latency_bound_us(i);
+		}
+		if(p99 == 0 && (uint64_t)count * 100 >= (uint64_t)total * 99){
+			p99 = cli_latency_bound_us(i);
+		}
+		printf("  < %8lu %10lu ", (unsigned long)cli_latency_bound_us(i), (unsigned long)histogram[i]);
+		for(uint32_t bar = (uint32_t)((uint64_t)histogram[i] * 40 / max); bar > 0; bar--){
+			putchar('#');
+		}
+		NL1();
+	}
+	printf("%lu bytes, 50%% < %lu us, 99%% < %lu us\n", (unsigned long)total, (unsigned long)p50, (unsigned long)p99);
+	return EXIT_SUCCESS;
+}
+#endif /* CLI_LATENCY */
+
+#if CLI_WATCH
+/**
+  * @brief  		finds the next line of a text
+  * @param  text:	current position in the text, moved past the line
+  * @param  end:	end of the text
+  * @param  len:	length of the line, without its end nor what is past CLI_WATCH_WIDTH
+  * @retval 		start of the line, NULL at the end of the text
+  */
+static const char *cli_watch_line(const char **text, const char *end, uint8_t *len)
+{
+	const char *line = *text;
+	const char *eol = line;
+
+	if(line >= end){
+		return NULL;
+	}
+	while(eol < end && *eol != '\n'){
+		eol++;
+	}
+	*text = (eol < end) ? eol + 1 : eol;
+	while(eol > line && eol[-1] == '\r'){
+		eol--;
+	}
+	*len = (eol - line < CLI_WATCH_WIDTH) ? (uint8_t)(eol - line) : CLI_WATCH_WIDTH;
+	return line;
+}
+
+/**
+  * @brief  turns the output shown into the new one: only the rows that changed are
+  * 		updated, each from its first difference (vt100_line_update)
+  * @param  null
+  * @retval null
+  */
+static void cli_watch_draw(void)
+{
+	char out[VT100_LINE_UPDATE_SIZE(CLI_WATCH_WIDTH)];
+	const char *old = watch.shown, *old_end = &watch.shown[watch.len];
+	const char *new = watch.next, *new_end = &watch.next[cli_capture.len];
+	const char *old_line, *new_line;
+	uint8_t old_len = 0, new_len = 0;
+	uint8_t row = 0;
+	uint8_t cursor = watch.rows;		/* row of the cursor */
+	bool home = true;					/* the cursor is at the start of its row */
+
+	for(row = 0; (new_line = cli_watch_line(&new, new_end, &new_len)) != NULL; row++){
+		old_line = cli_watch_line(&old, old_end, &old_len);
+		if(old_line == NULL){
+			/* new row, below the ones shown */
+			TERMINAL_MOVE_DOWN(watch.rows - cursor);
+			if(!home){
+				TERMINAL_MOVE_HOME();
+			}
+			printf("%.*s", new_len, new_line);NL1();
+			cursor = ++watch.rows;
+			home = true;
+			continue;
+		}
+		if(old_len == new_len && memcmp(old_line, new_line, new_len) == 0){
+			continue;
+		}
+
+		if(cursor > row){
+			TERMINAL_MOVE_UP(cursor - row);
+		}else{
+			TERMINAL_MOVE_DOWN(row - cursor);
+		}
+		if(!home){
+			TERMINAL_MOVE_HOME();
+		}
+		cursor = row;
+		home = false;
+		if(memchr(old_line, '\033', old_len) != NULL || memchr(new_line, '\033', new_len) != NULL){
+			/* the columns of a line with escape sequences are not known, it is written again */
+			printf("%.*s", new_len, new_line);
+			TERMINAL_CLEAR_END();
+		}else{
+			uint16_t n = vt100_line_update(out, (const uint8_t *)old_line, old_len, 0,
+											(const uint8_t *)new_line, new_len, VT100_CURSOR_KEEP);
+			fwrite(out, 1, n, stdout);
+		}
+	}
+
+	/* back to the start of the row below the output, the rows left from the previous one are cleared */
+	if(cursor > row){
+		TERMINAL_MOVE_UP(cursor - row);
+	}else{
+		TERMINAL_MOVE_DOWN(row - cursor);
+	}
+	if(!home){
+		TERMINAL_MOVE_HOME();
+	}
+	if(row < watch.rows){
+		TERMINAL_CLEAR_DOWN();
+	}
+	watch.rows = row;
+	watch.len = cli_capture.len;
+	memcpy(watch.shown, watch.next, cli_capture.len);
+}
+
+const char *cli_watch_complete(int argc, char *argv[], size_t index){
+	int first = (argc > 1 && strcmp(argv[1], "-n") == 0) ? 3 : 1;
+	return (argc > first) ? cli_complete_candidate(argc - first, &argv[first], index) : NULL;
+}
+
+/**
+  * @brief  runs a command periodically and redraws its output in place, called again by
+  * 		cli_run until a key is pressed
+  * @param  para addr. & length
+  * @retval CLI_WAITING, then EXIT_SUCCESS once stopped
+  */
+uint8_t cli_watch(int argc, char *argv[]){
+	uint32_t period = 1000;
+	int first = 1;					/* argv of the command watched */
+
+	if(argc > 2 && strcmp(argv[1], "-n") == 0){
+		char *end;
+		period = strtoul(argv[2], &end, 0);
+		if(*end != '\0' || period < CLI_WATCH_MIN_MS){
+			printf("The period of %s is a number of ms, at least %u.\n", argv[0], (unsigned int)CLI_WATCH_MIN_MS);
+			return EXIT_FAILURE;
+		}
+		first = 3;
+	}
+	if(argc <= first){
+		printf("Command %s takes the command to run. Use \"help %s\" for usage.\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+	cli_ctx_s *ctx = cli_ctx_current;
+	const COMMAND_S *cmd = cli_command_find(argv[first]);
+	if(cmd == NULL || cmd->pFun == NULL){
+		printf("Command \"%s\" unknown, try: help\n", argv[first]);
+		if(watch.ctx == ctx){
+			watch.ctx = NULL;
+		}
+		return EXIT_FAILURE;
+	}
+
+	if(!ctx->job.running){
+		if(watch.ctx != NULL){
+			/* its buffers are not per context */
+			printf("Command %s is used by another shell.\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		watch.ctx = ctx;
+		printf("Every %lu ms:", (unsigned long)period);
+		for(int i = first; i < argc; i++){
+			printf(" %s", argv[i]);
+		}
+		printf(", any key to stop");NL1();
+		watch.len = watch.rows = 0;
+		watch.last = HAL_GetTick() - period;
+	}else if(CLI_CANCELLED() || CLI_KEY_HIT()){
+		watch.ctx = NULL;
+		return EXIT_SUCCESS;
+	}
+	if(HAL_GetTick() - watch.last < period){
+		return CLI_WAITING;
+	}
+	watch.last = HAL_GetTick();
+
+	/* what was printed before goes to the terminal, the output of the command to watch.next */
+	fflush(stdout);
+	cli_capture.buff = watch.next;
+	cli_capture.size = sizeof(watch.next);
+	cli_capture.len = 0;
+	uint8_t result = cli_command_exec(cmd, argc - first, &argv[first]);
+	fflush(stdout);
+	cli_capture.buff = NULL;
+
+	cli_watch_draw();
+	if(CLI_NOT_DONE(result)){
+		printf(CLI_FONT_RED "%s does not return at once, it cannot be watched" CLI_FONT_DEFAULT, argv[first]);NL1();
+		watch.ctx = NULL;
+		return EXIT_FAILURE;
+	}
+	return CLI_WAITING;
+}
+#endif /* CLI_WATCH */
@@ -5,7 +5,10 @@
   * @version:   V1.0
   * @date:      2018-1-18
   * @brief:     queue
-  * @attention:
+  * @attention: the producer publishes Rear with a release store after writing the
+  *             data and the consumer publishes Front with a release store after
+  *             reading it. Each side loads the index of the other one with an
+  *             acquire load, so that the data is always seen before the index.
   ******************************************************************************
   */
 
@@ -14,16 +17,27 @@
 #include "../inc/sys_queue.h"
 #include "stdbool.h"
 
+#define QUEUE_LOAD_ACQUIRE(idx)			__atomic_load_n(&(idx), __ATOMIC_ACQUIRE)
+#define QUEUE_STORE_RELEASE(idx, val)	__atomic_store_n(&(idx), (val), __ATOMIC_RELEASE)
+
 /**
- * @brief  shell_queue_init inits the contents of the queue to zeros
+ * @brief  shell_queue_init inits the queue on the given storage
  * @param  queue
- * @retval True
+ * @param  pool: storage of the queue
+ * @param  length: length of pool, must be a power of two
+ * @retval True, False if length is not a power of two
  */
-uint8_t shell_queue_init(shell_queue_s *queue)
+uint8_t shell_queue_init(shell_queue_s *queue, uint8_t *pool, size_t length)
 {
+	if(!SHELL_QUEUE_IS_POW2(length)) {
+		return false;
+	}
+
 	queue->Front = queue->Rear = 0;
+	queue->Mask = length - 1;
+	queue->PBase = pool;
 
-    memset(queue->PBase, 0, SHELL_QUEUE_LENGTH);
+    memset(queue->PBase, 0, length);
 
     return true;
 }
@@ -36,11 +50,7 @@ uint8_t shell_queue_init(shell_queue_s *queue)
  */
 uint8_t shell_queue_full(shell_queue_s *queue)
 {
-    if((((queue->Rear) + 1) % SHELL_QUEUE_LENGTH) == queue->Front) {
-        return true;
-    } else {
-        return false;
-    }
+    return shell_queue_room(queue) == 0;
 }
 
 /**
@@ -50,11 +60,27 @@ uint8_t shell_queue_full(shell_queue_s *queue)
  */
 uint8_t shell_queue_empty(shell_queue_s *queue)
 {
-    if(queue->Front == queue->Rear) {
-        return true;
-    } else {
-        return false;
-    }
+    return shell_queue_count(queue) == 0;
+}
+
+/**
+ * @brief  shell_queue_count returns the number of bytes that can be read (consumer side)
+ * @param  queue
+ * @retval number of bytes in the queue
+ */
+size_t shell_queue_count(shell_queue_s *queue)
+{
+	return QUEUE_LOAD_ACQUIRE(queue->Rear) - queue->Front;
+}
+
+/**
+ * @brief  shell_queue_room returns the number of bytes that can be written (producer side)
+ * @param  queue
+ * @retval free space in the queue
+ */
+size_t shell_queue_room(shell_queue_s *queue)
+{
+	return (queue->Mask + 1) - (queue->Rear - QUEUE_LOAD_ACQUIRE(queue->Front));
 }
 
 
@@ -70,8 +96,8 @@ uint8_t shell_queue_in(shell_queue_s *queue, uint8_t *PData)
         return false;
     }
 
-    queue->PBase[queue->Rear] = *PData;
-    queue->Rear = ((queue->Rear) + 1) % SHELL_QUEUE_LENGTH;
+    queue->PBase[queue->Rear & queue->Mask] = *PData;
+    QUEUE_STORE_RELEASE(queue->Rear, queue->Rear + 1);
 
     return true;
 }
@@ -89,9 +115,130 @@ uint8_t shell_queue_out(shell_queue_s *queue, uint8_t *PData)
         return false;
     }
 
-    *PData = queue->PBase[queue->Front];
-    queue->Front = ((queue->Front) + 1) % SHELL_QUEUE_LENGTH;
+    *PData = queue->PBase[queue->Front & queue->Mask];
+    QUEUE_STORE_RELEASE(queue->Front, queue->Front + 1);
 
     return true;
 }
 
+/**
+ * @brief  shell_queue_in_bulk inserts as many bytes as possible in the queue
+ * @param  queue, data, len
+ * @retval number of bytes inserted
+ */
+size_t shell_queue_in_bulk(shell_queue_s *queue, const uint8_t *data, size_t len)
+{
+	size_t room = shell_queue_room(queue);
+	size_t pos = queue->Rear & queue->Mask;
+	size_t first;
+
+	if(len > room) {
+		len = room;
+	}
+
+	/* at most two copies: up to the end of the storage, then from its start */
+	first = (queue->Mask + 1) - pos;
+	if(first > len) {
+		first = len;
+	}
+	memcpy(&queue->PBase[pos], data, first);
+	memcpy(queue->PBase, &data[first], len - first);
+
+	QUEUE_STORE_RELEASE(queue->Rear, queue->Rear + len);
+
+	return len;
+}
+
+/**
+ * @brief  shell_queue_out_bulk removes as many bytes as possible from the queue
+ * @param  queue, data, len
+ * @retval number of bytes removed
+ */
+size_t shell_queue_out_bulk(shell_queue_s *queue, uint8_t *data, size_t len)
+{
+	size_t count = shell_queue_count(queue);
+	size_t pos = queue->Front & queue->Mask;
+	size_t first;
+
+	if(len > count) {
+		len = count;
+	}
+
+	first = (queue->Mask + 1) - pos;
+	if(first > len) {
+		first = len;
+	}
+	memcpy(data, &queue->PBase[pos], first);
+	memcpy(&data[first], queue->PBase, len - first);
+
+	QUEUE_STORE_RELEASE(queue->Front, queue->Front + len);
+
+	return len;
+}
+
+/**
+ * @brief  shell_queue_peek_span gives the largest contiguous region that can be read
+ *         without removing it from the queue. Use shell_queue_release once it is consumed.
+ * @param  queue
+ * @param  span: set to the start of the region
+ * @retval length of the region
+ */
+size_t shell_queue_peek_span(shell_queue_s *queue, uint8_t **span)
+{
+	size_t count = shell_queue_count(queue);
+	size_t pos = queue->Front & queue->Mask;
+
+	*span = &queue->PBase[pos];
+	if(count > (queue->Mask + 1) - pos) {
+		count = (queue->Mask + 1) - pos;
+	}
+
+	return count;
+}
+
+/**
+ * @brief  shell_queue_release removes len bytes, previously read in place, from the queue
+ * @param  queue, len
+ * @retval null
+ */
+void shell_queue_release(shell_queue_s *queue, size_t len)
+{
+	QUEUE_STORE_RELEASE(queue->Front, queue->Front + len);
+}
+
+/**
+ * @brief  shell_queue_reserve_span gives the largest contiguous region that can be written
+ *         in place (e.g. by a DMA). Use shell_queue_commit once it is filled.
+ * @param  queue
+ * @param  span: set to the start of the region
+ * @retval length of the region
+ */
+size_t shell_queue_reserve_span(shell_queue_s *queue, uint8_t **span)
+{
+	size_t room = shell_queue_room(queue);
+	size_t pos = queue->Rear & queue->Mask;
+
+	*span = &queue->PBase[pos];
+	if(room > (queue->Mask + 1) - pos) {
+		room = (queue->Mask + 1) - pos;
+	}
+
+	return room;
+}
+
+/**
+ * @brief  shell_queue_commit publishes len bytes written in place to the consumer
+ * @param  queue, len: at most the room in the queue, the bytes past it are not published
+ * @retval number of bytes published
+ */
+size_t shell_queue_commit(shell_queue_s *queue, size_t len)
+{
+	size_t room = shell_queue_room(queue);
+
+	if(len > room) {
+		len = room;
+	}
+	QUEUE_STORE_RELEASE(queue->Rear, queue->Rear + len);
+
+	return len;
+}
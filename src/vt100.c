@@ -0,0 +1,297 @@
+/*
+ * vt100.c
+ *
+ *  VT100 / ANSI input decoder: turns the bytes received from the terminal into
+ *  key events, one byte at a time and in constant time per byte.
+ *  Line update: computes the shortest output that redraws an edited line.
+ */
+
+#include <string.h>
+#include "../inc/vt100.h"
+
+enum {
+    DEC_GROUND = 0,
+    DEC_ESC,        /* received ESC */
+    DEC_CSI,        /* received ESC [ */
+    DEC_SS3,        /* received ESC O */
+};
+
+#define ASCII_ESC   0x1b
+#define ASCII_DEL   0x7f
+
+/**
+  * @brief          resets the decoder
+  * @param  dec:    decoder
+  * @retval         null
+  */
+void vt100_decoder_init(vt100_decoder_s *dec)
+{
+    memset(dec, 0, sizeof(*dec));
+}
+
+/**
+  * @brief          converts the xterm modifier parameter (1 + bit field) to VT100_MOD_xxx
+  */
+static uint8_t vt100_modifiers(const vt100_decoder_s *dec)
+{
+    if (dec->nparam < 2 || dec->param[1] < 2) {
+        return 0;
+    }
+    return (uint8_t)((dec->param[1] - 1) & (VT100_MOD_SHIFT | VT100_MOD_ALT | VT100_MOD_CTRL));
+}
+
+/**
+  * @brief          key of a final byte common to CSI and SS3 sequences
+  */
+static uint8_t vt100_cursor_key(uint8_t final)
+{
+    switch (final) {
+    case 'A': return VT100_KEY_UP;
+    case 'B': return VT100_KEY_DOWN;
+    case 'C': return VT100_KEY_RIGHT;
+    case 'D': return VT100_KEY_LEFT;
+    case 'H': return VT100_KEY_HOME;
+    case 'F': return VT100_KEY_END;
+    default:  return VT100_KEY_NONE;
+    }
+}
+
+/**
+  * @brief          key of a "ESC [ n ~" sequence
+  */
+static uint8_t vt100_tilde_key(uint16_t n)
+{
+    switch (n) {
+    case 1:
+    case 7: return VT100_KEY_HOME;
+    case 2: return VT100_KEY_INSERT;
+    case 3: return VT100_KEY_DELETE;
+    case 4:
+    case 8: return VT100_KEY_END;
+    case 5: return VT100_KEY_PAGE_UP;
+    case 6: return VT100_KEY_PAGE_DOWN;
+    default: return VT100_KEY_NONE;
+    }
+}
+
+/**
+  * @brief          decodes a plain byte (outside of any escape sequence)
+  */
+static uint8_t vt100_decode_ground(vt100_decoder_s *dec, uint8_t c, vt100_key_s *key)
+{
+    uint8_t last_cr = dec->last_cr;
+
+    dec->last_cr = (c == '\r');
+
+    switch (c) {
+    case ASCII_ESC:
+        dec->state = DEC_ESC;
+        return VT100_KEY_NONE;
+    case '\r':
+        return VT100_KEY_ENTER;
+    case '\n':
+        /* second half of a CR LF */
+        return last_cr ? VT100_KEY_NONE : VT100_KEY_ENTER;
+    case '\b':
+    case ASCII_DEL:
+        return VT100_KEY_BACKSPACE;
+    case '\t':
+        return VT100_KEY_TAB;
+    default:
+        break;
+    }
+
+    if (c >= 0x01 && c <= 0x1a) {
+        key->ch = (char)('a' + c - 1);
+        return VT100_KEY_CTRL;
+    }
+    if (c < 0x20) {
+        /* other C0 codes (NUL, FS, GS, RS, US) */
+        return VT100_KEY_NONE;
+    }
+
+    key->ch = (char)c;
+    return VT100_KEY_CHAR;
+}
+
+/**
+  * @brief          feeds one received byte to the decoder
+  * @param  dec:    decoder
+  * @param  c:      received byte
+  * @param  key:    set to the decoded key when the return value is not VT100_KEY_NONE
+  * @retval         decoded key (vt100_key_e), VT100_KEY_NONE if the byte does not complete a key
+  */
+uint8_t vt100_decode(vt100_decoder_s *dec, uint8_t c, vt100_key_s *key)
+{
+    key->key = VT100_KEY_NONE;
+    key->mod = 0;
+    key->ch = 0;
+
+    switch (dec->state) {
+    case DEC_ESC:
+        dec->state = DEC_GROUND;
+        if (c == '[') {
+            dec->state = DEC_CSI;
+            dec->nparam = 0;
+            dec->param[0] = dec->param[1] = 0;
+            return VT100_KEY_NONE;
+        } else if (c == 'O') {
+            dec->state = DEC_SS3;
+            return VT100_KEY_NONE;
+        } else if (c >= 0x20 && c < ASCII_DEL) {
+            /* Alt + char */
+            key->key = VT100_KEY_CHAR;
+            key->mod = VT100_MOD_ALT;
+            key->ch = (char)c;
+            return key->key;
+        }
+        /* ESC followed by a control byte: drop the ESC */
+        break;
+
+    case DEC_CSI:
+        if (c >= '0' && c <= '9') {
+            if (dec->nparam == 0) {
+                dec->nparam = 1;
+            }
+            if (dec->nparam <= VT100_MAX_PARAMS) {
+                uint16_t *p = &dec->param[dec->nparam - 1];
+                *p = (*p < 1000) ? (uint16_t)(*p * 10 + (c - '0')) : *p;
+            }
+            return VT100_KEY_NONE;
+        } else if (c == ';') {
+            if (dec->nparam == 0) {
+                dec->nparam = 1;
+            }
+            if (dec->nparam <= VT100_MAX_PARAMS) {
+                dec->nparam++;
+            }
+            return VT100_KEY_NONE;
+        } else if (c >= 0x20 && c <= 0x3f) {
+            /* other parameter or intermediate bytes: ignored */
+            return VT100_KEY_NONE;
+        } else if (c >= 0x40 && c <= 0x7e) {
+            dec->state = DEC_GROUND;
+            key->key = (c == '~') ? vt100_tilde_key(dec->param[0]) : vt100_cursor_key(c);
+            key->mod = (key->key != VT100_KEY_NONE) ? vt100_modifiers(dec) : 0;
+            return key->key;
+        }
+        /* control byte inside of a sequence: abort it */
+        dec->state = DEC_GROUND;
+        break;
+
+    case DEC_SS3:
+        dec->state = DEC_GROUND;
+        if (c >= 0x40 && c <= 0x7e) {
+            key->key = vt100_cursor_key(c);
+            return key->key;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    key->key = vt100_decode_ground(dec, c, key);
+    return key->key;
+}
+
+/**
+  * @brief          writes a "ESC [ n <final>" sequence
+  * @retval         number of characters written
+  */
+static uint16_t vt100_csi_n(char *out, uint16_t n, char final)
+{
+    uint16_t i = 0;
+
+    out[i++] = ASCII_ESC;
+    out[i++] = '[';
+    if (n >= 100) {
+        out[i++] = (char)('0' + n / 100);
+    }
+    if (n >= 10) {
+        out[i++] = (char)('0' + (n / 10) % 10);
+    }
+    out[i++] = (char)('0' + n % 10);
+    out[i++] = final;
+
+    return i;
+}
+
+/**
+  * @brief          moves the cursor from column from to column to, the displayed text
+  *                 between them must already be line
+  * @retval         number of characters written
+  */
+static uint16_t vt100_move(char *out, uint8_t from, uint8_t to, const uint8_t *line)
+{
+    uint16_t n;
+
+    if (to < from) {
+        n = from - to;
+        if (n <= 4) {
+            memset(out, '\b', n);
+            return n;
+        }
+        return vt100_csi_n(out, n, 'D');
+    }
+
+    n = to - from;
+    if (n <= 4) {
+        /* re-printing is not longer than ESC [ n C */
+        memcpy(out, &line[from], n);
+        return n;
+    }
+    return vt100_csi_n(out, n, 'C');
+}
+
+/**
+  * @brief              computes the update of a line displayed by the terminal
+  * @param  out:        output, of at least VT100_LINE_UPDATE_SIZE(len) characters
+  * @param  old:        line currently displayed
+  * @param  old_len:    its length
+  * @param  old_cursor: current cursor column
+  * @param  line:       line to display
+  * @param  len:        its length
+  * @param  cursor:     cursor column to leave the terminal at, VT100_CURSOR_KEEP for anywhere
+  * @retval             number of characters written in out
+  */
+uint16_t vt100_line_update(char *out, const uint8_t *old, uint8_t old_len, uint8_t old_cursor,
+                           const uint8_t *line, uint8_t len, uint8_t cursor)
+{
+    uint8_t min_len = (old_len < len) ? old_len : len;
+    uint8_t first = 0;      /* first column that differs */
+    uint8_t end = len;      /* end of the columns to write */
+    uint16_t n = 0;
+
+    while (first < min_len && old[first] == line[first]) {
+        first++;
+    }
+
+    if (first == len && old_len == len) {
+        /* same text, only the cursor moves */
+        return (cursor == VT100_CURSOR_KEEP) ? 0 : vt100_move(out, old_cursor, cursor, line);
+    }
+
+    if (old_len == len) {
+        /* nothing is shifted, the common end does not need to be written again */
+        while (end > first && old[end - 1] == line[end - 1]) {
+            end--;
+        }
+    }
+
+    n += vt100_move(&out[n], old_cursor, first, line);
+    memcpy(&out[n], &line[first], end - first);
+    n += end - first;
+
+    if (len < old_len) {
+        out[n++] = ASCII_ESC;
+        out[n++] = '[';
+        out[n++] = 'K';
+    }
+
+    if (cursor != VT100_CURSOR_KEEP) {
+        n += vt100_move(&out[n], end, cursor, line);
+    }
+
+    return n;
+}
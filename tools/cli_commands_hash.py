@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+cli_commands_hash.py
+
+Generates the index of the commands declared with CLI_COMMAND / CLI_COMMAND_COMPLETE:
+their table sorted by name, in flash, and its perfect hash table. The shell finds them
+in constant time, completes them by binary search and lists them in order without any
+RAM nor work at boot.
+
+    python3 tools/cli_commands_hash.py -o Core/Src/cli_commands_hash.c Core/Src Shell/src
+
+All the sources declaring commands (the shell included) must be scanned. Build the
+generated file with the project and define CLI_COMMANDS_HASH (e.g. in main.h). Run it
+again whenever a command is added or removed: the commands missing from the table are
+not found.
+
+The sources are scanned as they are, without the preprocessor: the table references the
+commands weakly, so that the ones compiled out by the configuration (e.g. latency
+without CLI_LATENCY) are left NULL instead of breaking the link. Their names stay in
+cli_commands_names, on which the binary search runs.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+COMMAND_RE = re.compile(r'^\s*CLI_COMMAND(?:_COMPLETE)?\s*\(\s*([A-Za-z_]\w*)\s*,', re.MULTILINE)
+SOURCE_EXT = ('.c', '.h', '.cpp', '.cc')
+MAX_SEED = 1 << 20
+
+
+def fnv1a(name, seed):
+    """Hash of a command name, must match cli_command_hash() in sys_command_line.c"""
+    h = 2166136261 ^ seed
+    for c in name.encode():
+        h ^= c
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def find_commands(paths):
+    commands = {}
+    for path in paths:
+        if os.path.isdir(path):
+            files = [os.path.join(root, f) for root, _, names in os.walk(path)
+                     for f in names if f.endswith(SOURCE_EXT)]
+        else:
+            files = [path]
+        for f in sorted(files):
+            with open(f, encoding='utf-8', errors='replace') as src:
+                for name in COMMAND_RE.findall(src.read()):
+                    if name in commands and commands[name] != f:
+                        sys.exit('command %s declared in %s and %s' % (name, commands[name], f))
+                    commands[name] = f
+    return sorted(commands)
+
+
+def find_seed(names):
+    """Smallest power of two table and seed without collisions"""
+    size = 1
+    while size < len(names):
+        size *= 2
+    while True:
+        for seed in range(MAX_SEED):
+            slots = {fnv1a(n, seed) & (size - 1) for n in names}
+            if len(slots) == len(names):
+                return size, seed
+        size *= 2
+
+
+def generate(names, size, seed):
+    table = [0] * size
+    for i, n in enumerate(names):
+        table[fnv1a(n, seed) & (size - 1)] = i + 1
+
+    out = ['/*',
+           ' * cli_commands_hash.c',
+           ' *',
+           ' *  Generated by tools/cli_commands_hash.py, do not edit.',
+           ' */',
+           '',
+           '#include "sys_command_line.h"',
+           '']
+    out += ['extern const COMMAND_S cli_command_%s __attribute__((weak));' % n for n in names]
+    out += ['',
+            'const COMMAND_S *const cli_commands_table[] = {']
+    out += ['\t&cli_command_%s,' % n for n in names]
+    out += ['};',
+            'const char *const cli_commands_names[] = {']
+    out += ['\t"%s",' % n for n in names]
+    out += ['};',
+            'const size_t cli_commands_table_nb = %d;' % len(names),
+            'const uint32_t cli_commands_hash_seed = %du;' % seed,
+            'const uint32_t cli_commands_hash_mask = %du;' % (size - 1),
+            'const uint16_t cli_commands_hash[%d] = {' % size]
+    for i in range(0, size, 16):
+        out.append('\t' + ' '.join('%d,' % v for v in table[i:i + 16]))
+    out += ['};', '']
+    return '\n'.join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('paths', nargs='+', help='source files or directories to scan')
+    parser.add_argument('-o', '--output', default='cli_commands_hash.c', help='generated file')
+    args = parser.parse_args()
+
+    names = find_commands(args.paths)
+    if not names:
+        sys.exit('no CLI_COMMAND found')
+    if len(names) >= 0xFFFF:
+        sys.exit('too many commands')
+
+    size, seed = find_seed(names)
+    with open(args.output, 'w') as f:
+        f.write(generate(names, size, seed))
+    print('%d commands, %d slots, seed %d' % (len(names), size, seed))
+
+
+if __name__ == '__main__':
+    main()
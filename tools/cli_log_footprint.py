@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""
+cli_log_footprint.py
+
+Measures the code size of the logs against CLI_LOG_LEVEL and CLI_LOG_COMPILE_MASK, to
+check what compiling them out saves.
+
+    python3 tools/cli_log_footprint.py
+    python3 tools/cli_log_footprint.py --cc arm-none-eabi-gcc --opt=-Os,-O2 -- -mcpu=cortex-m4 -mthumb -ICore/Inc ...
+
+A unit with 6 LOG, 2 DBG and 2 ERR calls over three categories is compiled for each
+configuration and optimization level, and the size of its code and constant data
+(.text and .rodata sections, in bytes) is printed. The default compiler builds it
+against the Linux port (port/linux); the arguments after -- are given to the compiler,
+e.g. the include directories of a project and its target flags.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+UNIT = r'''
+#define CLI_ADDITIONAL_LOG_CATEGORIES X(CAT1, true) X(CAT2, true) X(CAT3, true)
+#include "sys_command_line.h"
+
+void footprint(int a, int b)
+{
+	LOG(CLI_LOG_CAT1, "first value %d\n", a);
+	LOG(CLI_LOG_CAT1, "second value %d and %d\n", a, b);
+	LOG(CLI_LOG_CAT2, "state of the second category: %d\n", b);
+	LOG(CLI_LOG_CAT2, "sum %d\n", a + b);
+	LOG(CLI_LOG_CAT3, "third category, %d\n", a * b);
+	LOG(CLI_LOG_CAT3, "done\n");
+	DBG("debug %d %d\n", a, b);
+	DBG("debug again\n");
+	ERR("error %d\n", a);
+	ERR("another error\n");
+}
+'''
+
+CONFIGS = [
+    ('default (everything)', []),
+    ('CLI_LOG_LEVEL=CLI_LEVEL_LOG', ['-DCLI_LOG_LEVEL=CLI_LEVEL_LOG']),
+    ('LOG level, mask = 1 category', ['-DCLI_LOG_LEVEL=CLI_LEVEL_LOG',
+                                      '-DCLI_LOG_COMPILE_MASK=(1UL<<CLI_LOG_CAT1)']),
+    ('mask = 1 category only', ['-DCLI_LOG_COMPILE_MASK=(1UL<<CLI_LOG_CAT1)']),
+    ('CLI_LOG_LEVEL=CLI_LEVEL_ERROR', ['-DCLI_LOG_LEVEL=CLI_LEVEL_ERROR']),
+    ('CLI_LOG_LEVEL=CLI_LEVEL_NONE', ['-DCLI_LOG_LEVEL=CLI_LEVEL_NONE']),
+]
+
+SECTION_RE = re.compile(r'^(\.text|\.rodata)\S*\s+(\d+)', re.MULTILINE)
+
+
+def footprint(cc, size, flags, source, obj):
+    subprocess.run([cc, '-std=gnu11', '-c', source, '-o', obj] + flags, check=True)
+    sections = subprocess.run([size, '-A', obj], check=True, capture_output=True, text=True).stdout
+    return sum(int(n) for _, n in SECTION_RE.findall(sections))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--cc', default='gcc', help='compiler (default gcc, on the Linux port)')
+    parser.add_argument('--size', help='size tool, by default the one next to the compiler')
+    parser.add_argument('--opt', default='-O0,-Os', help='optimization levels, separated by commas')
+    parser.add_argument('flags', nargs='*', help='compiler arguments, after --')
+    args = parser.parse_args()
+    opts = args.opt.split(',')
+
+    size = args.size or re.sub(r'(g?cc|clang)$', 'size', args.cc)
+    if size == args.cc:
+        size = 'size'
+    flags = args.flags or ['-I' + os.path.join(ROOT, 'port', 'linux')]
+    flags = flags + ['-I' + os.path.join(ROOT, 'inc')]
+
+    with tempfile.TemporaryDirectory() as tmp:
+        source = os.path.join(tmp, 'footprint.c')
+        obj = os.path.join(tmp, 'footprint.o')
+        with open(source, 'w') as f:
+            f.write(UNIT)
+
+        print('%-38s' % 'configuration' + ''.join('%7s' % o for o in opts))
+        for name, defines in CONFIGS:
+            sizes = [footprint(args.cc, size, [opt] + defines + flags, source, obj) for opt in opts]
+            print('%-38s' % name + ''.join('%7d' % s for s in sizes))
+    print('(bytes of .text and .rodata of a unit with 6 LOG, 2 DBG and 2 ERR calls)')
+
+
+if __name__ == '__main__':
+    try:
+        main()
+    except subprocess.CalledProcessError as e:
+        sys.exit('%s failed' % ' '.join(e.cmd))